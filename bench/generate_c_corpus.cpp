@@ -0,0 +1,277 @@
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+// generate_c_corpus : writes a synthetic C corpus for generate_header_bench.
+// the corpus is deterministic: the same options (and --seed) always give the same files.
+//      <out dir>/corpus_<n>.c       the .c files: functions with random signatures and bodies
+//      <out dir>/corpus_local_<n>.h the local headers included by the .c files (--local-includes): typedefs + macros
+
+/*-----------------------------------------------------------------------------------------------*/
+/* classes                                                                             */
+/*-----------------------------------------------------------------------------------------------*/
+
+// CorpusOptions : the scale of the corpus
+struct CorpusOptions {
+    std::string OutDir = "corpus";
+    unsigned Files = 10;
+    unsigned FunctionsPerFile = 100;
+    unsigned MaxParams = 6;
+    unsigned VariadicPercent = 5;
+    unsigned StaticPercent = 20;
+    unsigned ExternPercent = 10;
+    unsigned SystemIncludes = 4;  //system headers included by each .c file, on top of the ones the corpus needs
+    unsigned LocalHeaders = 10;   //local headers in the corpus
+    unsigned LocalIncludes = 0;   //local headers included by each .c file (include fan-out)
+    unsigned BodyLines = 10;      //statements in each function body
+    unsigned Seed = 1;
+};
+
+
+// CType : a type of the corpus, and how a value of this type is used in a function body
+struct CType {
+    std::string Name;
+    bool IsPointer;
+};
+
+
+// CorpusWriter : writes the files of the corpus
+// members: Options, Random, Types
+class CorpusWriter {
+private:
+    const CorpusOptions &Options;
+    std::mt19937 Random;
+    std::vector<CType> Types;
+
+    //the headers every .c file includes: the types and va_list used by the functions come from them
+    static constexpr const char *RequiredHeaders[] = {"stddef.h", "stdint.h", "stdbool.h", "stdarg.h"};
+    //the headers picked by --system-includes
+    static constexpr const char *OptionalHeaders[] = {"stdio.h", "stdlib.h", "string.h", "math.h", "ctype.h", "errno.h",
+                                                      "limits.h", "time.h", "assert.h", "signal.h", "inttypes.h", "float.h",
+                                                      "locale.h", "setjmp.h", "wchar.h", "fenv.h"};
+
+    unsigned pick(unsigned Count) {
+        return std::uniform_int_distribution<unsigned>(0, Count - 1)(Random);
+    }
+
+    bool percent(unsigned Percent) {
+        return pick(100) < Percent;
+    }
+
+    //"corpus_local_<n>.h": each local header declares a typedef and a macro
+    bool writeLocalHeader(unsigned Index) {
+        SmallString<256> Path(Options.OutDir);
+        sys::path::append(Path, "corpus_local_" + std::to_string(Index) + ".h");
+        std::error_code EC;
+        raw_fd_ostream OS(Path, EC);
+        if (EC) {
+            errs() << "Error: Could not write " << Path << ": " << EC.message() << "\n";
+            return false;
+        }
+
+        std::string Guard = "CORPUS_LOCAL_" + std::to_string(Index) + "_H_";
+        OS << "#ifndef " << Guard << "\n#define " << Guard << "\n\n";
+        OS << "#include <stdint.h>\n\n";
+        OS << "typedef int32_t corpus_t" << Index << ";\n";
+        OS << "#define CORPUS_SCALE_" << Index << " " << (Index + 2) << "\n";
+        OS << "\n#endif // " << Guard << "\n";
+        return true;
+    }
+
+    //a statement of a function body that uses the parameter Param
+    void writeStatement(raw_ostream &OS, const CType &Type, const std::string &Param, unsigned Line) {
+        if (Type.IsPointer) {
+            OS << "    acc += (long)(" << Param << " != 0) * " << Line + 1 << ";\n";
+        }
+        else {
+            OS << "    acc += (long)" << Param << " * " << Line + 1 << ";\n";
+        }
+    }
+
+    void writeFunction(raw_ostream &OS, unsigned FileIndex, unsigned FunctionIndex) {
+        bool IsVariadic = percent(Options.VariadicPercent);
+        unsigned StorageClass = pick(100);
+        if (StorageClass < Options.StaticPercent) {
+            OS << "static ";
+        }
+        else
+        if (StorageClass < Options.StaticPercent + Options.ExternPercent) {
+            OS << "extern ";
+        }
+
+        //a void return type, or one of the corpus types
+        int ReturnType = static_cast<int>(pick(Types.size() + 1)) - 1;
+        OS << (ReturnType < 0 ? "void" : Types[ReturnType].Name) << " fn_" << FileIndex << "_" << FunctionIndex << "(";
+
+        //a variadic function needs at least one named parameter ; the last one is an int (va_start)
+        unsigned NumParams = pick(Options.MaxParams + 1);
+        if (IsVariadic) {
+            NumParams = std::max(NumParams, 1u);
+        }
+        std::vector<unsigned> ParamTypes;
+        for (unsigned p = 0; p < NumParams; ++p) {
+            ParamTypes.push_back(IsVariadic && p == NumParams - 1 ? 0 : pick(Types.size()));
+            OS << (p ? ", " : "") << Types[ParamTypes.back()].Name << " p" << p;
+        }
+        if (IsVariadic) {
+            OS << ", ...";
+        }
+        else
+        if (NumParams == 0) {
+            OS << "void";
+        }
+        OS << ")\n{\n";
+
+        OS << "    long acc = " << FunctionIndex << ";\n";
+        if (IsVariadic) {
+            OS << "    va_list ap;\n    va_start(ap, p" << NumParams - 1 << ");\n    acc += va_arg(ap, int);\n    va_end(ap);\n";
+        }
+        for (unsigned Line = 0; Line < Options.BodyLines; ++Line) {
+            if (NumParams == 0) {
+                OS << "    acc = acc * 31 + " << Line << ";\n";
+            }
+            else {
+                unsigned p = Line % NumParams;
+                writeStatement(OS, Types[ParamTypes[p]], "p" + std::to_string(p), Line);
+            }
+        }
+
+        if (ReturnType >= 0) {
+            if (Types[ReturnType].IsPointer) {
+                OS << "    return (" << Types[ReturnType].Name << ")0;\n";
+            }
+            else {
+                OS << "    return (" << Types[ReturnType].Name << ")acc;\n";
+            }
+        }
+        else {
+            OS << "    (void)acc;\n";
+        }
+        OS << "}\n\n";
+    }
+
+    bool writeSourceFile(unsigned Index) {
+        SmallString<256> Path(Options.OutDir);
+        sys::path::append(Path, "corpus_" + std::to_string(Index) + ".c");
+        std::error_code EC;
+        raw_fd_ostream OS(Path, EC);
+        if (EC) {
+            errs() << "Error: Could not write " << Path << ": " << EC.message() << "\n";
+            return false;
+        }
+
+        for (const char *Header : RequiredHeaders) {
+            OS << "#include <" << Header << ">\n";
+        }
+        unsigned NumOptional = std::min<unsigned>(Options.SystemIncludes, std::size(OptionalHeaders));
+        for (unsigned h = 0; h < NumOptional; ++h) {
+            OS << "#include <" << OptionalHeaders[h] << ">\n";
+        }
+        for (unsigned h = 0; h < Options.LocalIncludes && Options.LocalHeaders > 0; ++h) {
+            OS << "#include \"corpus_local_" << (Index + h) % Options.LocalHeaders << ".h\"\n";
+        }
+        OS << "\n\n";
+
+        for (unsigned f = 0; f < Options.FunctionsPerFile; ++f) {
+            writeFunction(OS, Index, f);
+        }
+        return true;
+    }
+
+public:
+    //ctor
+    explicit CorpusWriter(const CorpusOptions &Options) : Options(Options), Random(Options.Seed) {
+        Types = {{"int", false},       {"unsigned int", false}, {"long", false},  {"double", false},
+                 {"char *", true},     {"const char *", true},  {"size_t", false}, {"uint8_t", false},
+                 {"int32_t", false},   {"bool", false},         {"void *", true},  {"const int *", true}};
+    }
+
+    bool write() {
+        if (std::error_code EC = sys::fs::create_directories(Options.OutDir)) {
+            errs() << "Error: Could not create directory " << Options.OutDir << ": " << EC.message() << "\n";
+            return false;
+        }
+        if (Options.LocalIncludes > 0) {
+            for (unsigned h = 0; h < Options.LocalHeaders; ++h) {
+                if (!writeLocalHeader(h)) {
+                    return false;
+                }
+            }
+        }
+        for (unsigned f = 0; f < Options.Files; ++f) {
+            if (!writeSourceFile(f)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+
+
+
+/*-----------------------------------------------------------------------------------------------*/
+/* main function                                                                             */
+/*-----------------------------------------------------------------------------------------------*/
+
+// typed command must have the format:
+// generate_c_corpus [--out corpus/] [--files 10] [--functions 100] [--max-params 6] [--variadic 5] [--static 20]
+//                   [--extern 10] [--system-includes 4] [--local-headers 10] [--local-includes 0] [--body-lines 10] [--seed 1]
+// (--variadic, --static and --extern are percentages of the functions)
+int main(int argc, const char **argv) {
+    CorpusOptions Options;
+
+    //the numeric options and the members they set
+    const std::pair<const char *, unsigned *> NumericOptions[] = {
+        {"--files", &Options.Files},
+        {"--functions", &Options.FunctionsPerFile},
+        {"--max-params", &Options.MaxParams},
+        {"--variadic", &Options.VariadicPercent},
+        {"--static", &Options.StaticPercent},
+        {"--extern", &Options.ExternPercent},
+        {"--system-includes", &Options.SystemIncludes},
+        {"--local-headers", &Options.LocalHeaders},
+        {"--local-includes", &Options.LocalIncludes},
+        {"--body-lines", &Options.BodyLines},
+        {"--seed", &Options.Seed},
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        std::string Arg = argv[i];
+        if (i + 1 >= argc) {
+            errs() << "Error: Missing value for " << Arg << "\n";
+            return 1;
+        }
+
+        if (Arg == "--out") {
+            Options.OutDir = argv[++i];
+            continue;
+        }
+
+        auto Option = std::find_if(std::begin(NumericOptions), std::end(NumericOptions),
+                                   [&](const auto &O) { return Arg == O.first; });
+        if (Option == std::end(NumericOptions)) {
+            errs() << "Error: Unknown option " << Arg << "\n";
+            return 1;
+        }
+        if (StringRef(argv[++i]).getAsInteger(10, *Option->second)) {
+            errs() << "Error: " << Arg << " expects a number, got " << argv[i] << "\n";
+            return 1;
+        }
+    }
+
+    if (!CorpusWriter(Options).write()) {
+        return 1;
+    }
+    outs() << "Generated " << Options.Files << " .c files with " << Options.FunctionsPerFile << " functions each in "
+           << Options.OutDir << ".\n";
+    return 0;
+}
@@ -0,0 +1,492 @@
+#include "header_generator.h"
+
+#include "clang/Frontend/FrontendActions.h" //PreprocessOnlyAction: the preprocess phase
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h" //used to run each phase in its own process
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+
+#include <atomic>
+#include <chrono>
+
+#include <sys/resource.h> //getrusage: peak RSS
+
+using namespace clang;
+using namespace clang::tooling;
+using namespace llvm;
+using namespace headergen;
+
+// generate_header_bench : measures the time, the throughput and the peak memory of generate_header_tool
+// on a set of .c files (ex: a corpus made by generate_c_corpus), phase by phase:
+//      - preprocess : the preprocessor only
+//      - parse      : preprocess + parse (the AST is built, nothing else)
+//      - traverse   : preprocess + parse + the functions declarations are collected (parseAndTraverse: only the top
+//                     level declarations of the .c file, like the tool ; --full-traversal: the whole AST, included
+//                     headers too)
+//      - emit       : the whole tool: preprocess + parse + traverse + the .h files are written
+// each phase runs in its own process (this executable with --phase), so that the peak RSS of a phase
+// doesnt include the memory of the phases before it. the cost of a phase alone is the difference between
+// a phase and the one before it.
+
+/*-----------------------------------------------------------------------------------------------*/
+/* classes                                                                             */
+/*-----------------------------------------------------------------------------------------------*/
+
+// PhaseResult : what a phase process reports to the bench process
+struct PhaseResult {
+    std::string Phase;
+    size_t TUs = 0;
+    size_t Functions = 0;
+    double WallSeconds = 0;
+    long PeakRSSKB = 0;
+};
+
+
+
+
+/*-----------------------------------------------------------------------------------------------*/
+/* helpers                                                                             */
+/*-----------------------------------------------------------------------------------------------*/
+
+static const char *const Phases[] = {"preprocess", "parse", "traverse", "emit"};
+
+// runs a phase on all the .c files (in this process) ; returns the number of failed .c files
+// WallSeconds: the time spent on the .c files (the PCH preparation isnt measured)
+static size_t runPhase(StringRef Phase, const std::vector<std::string> &SourceFiles, const std::string &OutDir,
+                       const std::string &PCHDir, const GeneratorOptions &Options, bool FullTraversal, unsigned Jobs,
+                       std::atomic<size_t> &FunctionCount, double &WallSeconds) {
+    std::string CWD = ".";
+    std::vector<std::string> Flags = getCompilationFlags();
+    clang::tooling::FixedCompilationDatabase Compilations(CWD, Flags);
+    clang::tooling::FixedCompilationDatabase CXXCompilations(CWD, getCompilationFlags(true));
+
+    //same PCH as generate_header_tool --pch-dir ; it is built (or checked) before the time measurement starts
+    std::vector<bool> UsesPrefix(SourceFiles.size(), false);
+    std::unique_ptr<PrecompiledPrefix> Prefix;
+    std::unique_ptr<clang::tooling::FixedCompilationDatabase> PrefixCompilations;
+    if (!PCHDir.empty()) {
+        Prefix = preparePrecompiledPrefix(PCHDir, SourceFiles, Flags, UsesPrefix);
+    }
+    if (Prefix) {
+        PrefixCompilations = std::make_unique<clang::tooling::FixedCompilationDatabase>(CWD, Prefix->getFlags(Flags));
+    }
+    auto compilationsFor = [&](size_t i) -> const CompilationDatabase & {
+        if (isCXXSourceFile(SourceFiles[i])) {
+            return CXXCompilations;
+        }
+        return UsesPrefix[i] ? *PrefixCompilations : Compilations;
+    };
+
+    //the .h files of a previous run are removed: the emit phase always writes them
+    std::vector<std::string> HFileNames;
+    for (size_t i = 0; i < SourceFiles.size(); ++i) {
+        SmallString<256> HFileName(OutDir);
+        llvm::sys::path::append(HFileName, std::to_string(i) + "_" + llvm::sys::path::filename(SourceFiles[i]).str());
+        llvm::sys::path::replace_extension(HFileName, "h");
+        HFileNames.push_back(HFileName.str().str());
+        if (Phase == "emit") {
+            llvm::sys::fs::remove(HFileNames.back());
+        }
+    }
+
+    auto Start = std::chrono::steady_clock::now();
+    std::atomic<size_t> Failed(0);
+    llvm::DefaultThreadPool Pool(llvm::hardware_concurrency(Jobs));
+    for (size_t i = 0; i < SourceFiles.size(); ++i) {
+        Pool.async([&, i] {
+            int Result = 0;
+            if (Phase == "emit") {
+                Result = generateHeader(compilationsFor(i), SourceFiles[i], HFileNames[i], Options, nullptr, nullptr);
+            }
+            else
+            if (Phase == "preprocess") {
+                IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS(llvm::vfs::createPhysicalFileSystem().release());
+                clang::tooling::ClangTool Tool(compilationsFor(i), {SourceFiles[i]}, std::make_shared<PCHContainerOperations>(), FS);
+                Result = Tool.run(newFrontendActionFactory<PreprocessOnlyAction>().get());
+            }
+            else {
+                //parse and traverse: the AST is built by the library, as generate_header_tool builds it
+                TraversalMode Mode = Phase != "traverse" ? TraversalMode::None
+                                     : FullTraversal    ? TraversalMode::Full
+                                                        : TraversalMode::Pruned;
+                std::optional<size_t> Functions = parseAndTraverse(compilationsFor(i), SourceFiles[i], Options, Mode);
+                FunctionCount += Functions.value_or(0);
+                Result = Functions ? 0 : 1;
+            }
+            if (Result != 0) {
+                Failed++;
+            }
+        });
+    }
+    Pool.wait();
+
+    WallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+    return Failed;
+}
+
+// runs a phase in a new process (this executable with --phase) and reads its result
+static std::optional<PhaseResult> runPhaseProcess(StringRef Phase, StringRef BenchExecutable, ArrayRef<std::string> PhaseArgs) {
+    SmallString<128> ResultFile;
+    if (llvm::sys::fs::createTemporaryFile("generate_header_bench", "txt", ResultFile)) {
+        errs() << "Error: Could not create a temporary file.\n";
+        return std::nullopt;
+    }
+
+    std::vector<StringRef> Args = {BenchExecutable, "--phase", Phase, "--result-file", ResultFile};
+    Args.insert(Args.end(), PhaseArgs.begin(), PhaseArgs.end());
+    //the phase process prints one line per .h file: not needed here
+    std::optional<StringRef> Redirects[] = {std::nullopt, StringRef(""), std::nullopt};
+    std::string ErrMsg;
+    int ExitCode = llvm::sys::ExecuteAndWait(BenchExecutable, Args, std::nullopt, Redirects, 0, 0, &ErrMsg);
+    if (ExitCode < 0) {
+        errs() << "Error: Could not run the phase " << Phase << ": " << ErrMsg << "\n";
+        return std::nullopt;
+    }
+
+    // the result file has the format: <TUs> <functions> <wall seconds> <peak RSS in KB>
+    auto Buffer = MemoryBuffer::getFile(ResultFile);
+    llvm::sys::fs::remove(ResultFile);
+    if (!Buffer) {
+        errs() << "Error: The phase " << Phase << " didnt report a result.\n";
+        return std::nullopt;
+    }
+    SmallVector<StringRef, 4> Fields;
+    (*Buffer)->getBuffer().trim().split(Fields, ' ');
+    PhaseResult Result;
+    Result.Phase = Phase.str();
+    if (Fields.size() != 4 || Fields[0].getAsInteger(10, Result.TUs) || Fields[1].getAsInteger(10, Result.Functions) ||
+        Fields[2].getAsDouble(Result.WallSeconds) || Fields[3].getAsInteger(10, Result.PeakRSSKB)) {
+        errs() << "Error: The phase " << Phase << " reported an invalid result.\n";
+        return std::nullopt;
+    }
+    if (ExitCode != 0) {
+        errs() << "Warning: some .c files failed in the phase " << Phase << ".\n";
+    }
+    return Result;
+}
+
+
+// runs a command ; adds its wall time to Seconds. returns false (and prints the command) if it fails
+static bool runTimed(StringRef Program, ArrayRef<std::string> Args, double &Seconds) {
+    std::vector<StringRef> ArgRefs = {Program};
+    ArgRefs.insert(ArgRefs.end(), Args.begin(), Args.end());
+    std::string ErrMsg;
+    auto Start = std::chrono::steady_clock::now();
+    int ExitCode = llvm::sys::ExecuteAndWait(Program, ArgRefs, std::nullopt, {}, 0, 0, &ErrMsg);
+    Seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+    if (ExitCode != 0) {
+        errs() << "Error: failed:";
+        for (StringRef Arg : ArgRefs) {
+            errs() << " " << Arg;
+        }
+        errs() << (ErrMsg.empty() ? "" : ": ") << ErrMsg << "\n";
+        return false;
+    }
+    return true;
+}
+
+// downstream mode (--downstream): the compile time of the C++ files that use the generated declarations, with a
+// textual #include of the .h files versus an import of the modules of the .cppm files (--emit-module).
+// each .c file gets a .h file, a .cppm file (precompiled once into a BMI: .pcm) and Consumers C++ files of each kind.
+// the compilations are -fsyntax-only (the front end is what the module saves) and run one at a time
+static int runDownstream(const std::vector<std::string> &SourceFiles, const std::string &OutDir,
+                         const GeneratorOptions &Options, unsigned Consumers, StringRef Clang) {
+    clang::tooling::FixedCompilationDatabase Compilations(".", getCompilationFlags());
+    clang::tooling::FixedCompilationDatabase CXXCompilations(".", getCompilationFlags(true));
+    GeneratorOptions TextualOptions = Options;
+    TextualOptions.EmitModule = false;
+    GeneratorOptions ModuleOptions = Options;
+    ModuleOptions.EmitModule = true;
+
+    double BMISeconds = 0, TextualSeconds = 0, ModuleSeconds = 0;
+    for (size_t i = 0; i < SourceFiles.size(); ++i) {
+        const CompilationDatabase &FileCompilations = isCXXSourceFile(SourceFiles[i]) ? CXXCompilations : Compilations;
+        SmallString<256> Base(OutDir);
+        llvm::sys::path::append(Base, std::to_string(i) + "_" + llvm::sys::path::stem(SourceFiles[i]).str());
+        std::string HFileName = (Base + ".h").str();
+        std::string ModuleFileName = (Base + ".cppm").str();
+        std::string BMIFileName = (Base + ".pcm").str();
+        std::string ModuleName = deriveModuleName(ModuleFileName);
+
+        //the quoted #include lines of the .c file are found next to it
+        SmallString<256> SourceDir = llvm::sys::path::parent_path(SourceFiles[i]);
+        std::string IncludeSourceDir = "-I" + (SourceDir.empty() ? std::string(".") : SourceDir.str().str());
+
+        //the .h file of a .c file is a C header included by a C++ file: the C spellings that C++ doesnt have are
+        //mapped to their C++ ones (the .cppm file is already written with them)
+        std::vector<std::string> TextualArgs = {"-std=c++20", IncludeSourceDir};
+        if (!isCXXSourceFile(SourceFiles[i])) {
+            TextualArgs.insert(TextualArgs.end(), {"-Drestrict=__restrict", "-D_Bool=bool"});
+        }
+
+        if (generateHeader(FileCompilations, SourceFiles[i], HFileName, TextualOptions, nullptr, nullptr) != 0 ||
+            generateHeader(FileCompilations, SourceFiles[i], ModuleFileName, ModuleOptions, nullptr, nullptr) != 0) {
+            return 1;
+        }
+        if (!runTimed(Clang, {"-std=c++20", IncludeSourceDir, "--precompile", ModuleFileName, "-o", BMIFileName}, BMISeconds)) {
+            return 1;
+        }
+
+        for (unsigned k = 0; k < Consumers; ++k) {
+            std::string Function = "consumer_" + std::to_string(i) + "_" + std::to_string(k);
+            std::string TextualFile = (Base + "_textual_" + std::to_string(k) + ".cpp").str();
+            std::string ModuleFile = (Base + "_module_" + std::to_string(k) + ".cpp").str();
+            std::error_code EC;
+            {
+                raw_fd_ostream OS(TextualFile, EC);
+                OS << "#include \"" << llvm::sys::path::filename(HFileName) << "\"\n\nint " << Function << "() { return 0; }\n";
+            }
+            {
+                raw_fd_ostream OS(ModuleFile, EC);
+                OS << "import " << ModuleName << ";\n\nint " << Function << "() { return 0; }\n";
+            }
+            if (EC) {
+                errs() << "Error: Could not write the downstream files in " << OutDir << ": " << EC.message() << "\n";
+                return 1;
+            }
+
+            std::vector<std::string> TextualFileArgs = TextualArgs;
+            TextualFileArgs.insert(TextualFileArgs.end(), {"-fsyntax-only", TextualFile});
+            if (!runTimed(Clang, TextualFileArgs, TextualSeconds) ||
+                !runTimed(Clang, {"-std=c++20", "-fmodule-file=" + ModuleName + "=" + BMIFileName, "-fsyntax-only", ModuleFile},
+                          ModuleSeconds)) {
+                return 1;
+            }
+        }
+    }
+
+    size_t TUs = SourceFiles.size() * Consumers;
+    outs() << "\n" << SourceFiles.size() << " .c files, " << Consumers << " C++ files per .c file (" << Clang << ")\n\n";
+    outs() << left_justify("mode", 10) << right_justify("BMIs (s)", 12) << right_justify("TUs (s)", 12)
+           << right_justify("per TU (ms)", 14) << right_justify("total (s)", 12) << "\n";
+    outs() << left_justify("textual", 10) << right_justify("-", 12)
+           << right_justify(formatv("{0:F3}", TextualSeconds).str(), 12)
+           << right_justify(formatv("{0:F1}", 1000 * TextualSeconds / std::max<size_t>(TUs, 1)).str(), 14)
+           << right_justify(formatv("{0:F3}", TextualSeconds).str(), 12) << "\n";
+    outs() << left_justify("module", 10) << right_justify(formatv("{0:F3}", BMISeconds).str(), 12)
+           << right_justify(formatv("{0:F3}", ModuleSeconds).str(), 12)
+           << right_justify(formatv("{0:F1}", 1000 * ModuleSeconds / std::max<size_t>(TUs, 1)).str(), 14)
+           << right_justify(formatv("{0:F3}", BMISeconds + ModuleSeconds).str(), 12) << "\n";
+    return 0;
+}
+
+
+
+/*-----------------------------------------------------------------------------------------------*/
+/* main function                                                                             */
+/*-----------------------------------------------------------------------------------------------*/
+
+// typed command must have the format:
+// generate_header_bench corpus_dir/ [-j 8] [--repeat 3] [--skip-bodies] [--pch-dir my_pch_dir] [--out-dir bench_out/]
+//                       [--full-traversal] [--engine lexer] (the emit phase with the lexer engine)
+// OR (downstream compile time: textual #include of the .h files versus import of their modules ; see runDownstream)
+// generate_header_bench corpus_dir/ --downstream [--downstream-tus 10] [--clang clang++] [--out-dir bench_out/]
+int main(int argc, const char **argv) {
+
+    std::vector<std::string> SourceFiles;
+    std::vector<std::string> PhaseArgs; //the args given to each phase process
+    std::string Phase;
+    std::string ResultFileName;
+    std::string OutDir = "generate_header_bench_out";
+    std::string PCHDir;
+    GeneratorOptions Options;
+    unsigned Jobs = 0;
+    unsigned Repeat = 1;
+    bool FullTraversal = false;
+    bool Downstream = false;
+    unsigned Consumers = 10;
+    std::string Clang;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string Arg = argv[i];
+
+        //an option followed by a value cant be the last argv parameter (its value isnt a .c file)
+        bool TakesValue = StringSwitch<bool>(Arg)
+                              .Cases("--phase", "--result-file", "--repeat", "-j", "--out-dir", "--pch-dir", true)
+                              .Cases("--engine", "--downstream-tus", "--clang", true)
+                              .Default(false);
+        if (TakesValue && i + 1 >= argc) {
+            errs() << "Error: Missing value for " << Arg << ".\n";
+            return 1;
+        }
+
+        //--phase and --result-file: this process is a phase process
+        if (Arg == "--phase") {
+            Phase = argv[++i];
+        }
+        else
+        if (Arg == "--result-file") {
+            ResultFileName = argv[++i];
+        }
+        else
+        if (Arg == "--repeat") {
+            if (StringRef(argv[++i]).getAsInteger(10, Repeat)) {
+                errs() << "Error: --repeat expects a number of runs, got " << argv[i] << ".\n";
+                return 1;
+            }
+            Repeat = std::max(1u, Repeat);
+        }
+        else
+        if (Arg == "-j") {
+            PhaseArgs.push_back(Arg);
+            PhaseArgs.push_back(argv[++i]);
+            if (StringRef(PhaseArgs.back()).getAsInteger(10, Jobs)) {
+                errs() << "Error: -j expects a number of jobs, got " << PhaseArgs.back() << ".\n";
+                return 1;
+            }
+        }
+        else
+        if (Arg == "--out-dir") {
+            PhaseArgs.push_back(Arg);
+            PhaseArgs.push_back(argv[++i]);
+            OutDir = PhaseArgs.back();
+        }
+        else
+        if (Arg == "--pch-dir") {
+            PhaseArgs.push_back(Arg);
+            PhaseArgs.push_back(argv[++i]);
+            PCHDir = PhaseArgs.back();
+        }
+        else
+        if (Arg == "--skip-bodies") {
+            PhaseArgs.push_back(Arg);
+            Options.SkipFunctionBodies = true;
+        }
+        else
+        if (Arg == "--engine") {
+            PhaseArgs.push_back(Arg);
+            PhaseArgs.push_back(argv[++i]);
+            if (PhaseArgs.back() != "lexer" && PhaseArgs.back() != "ast") {
+                errs() << "Error: --engine expects lexer or ast, got " << PhaseArgs.back() << ".\n";
+                return 1;
+            }
+            Options.Engine = PhaseArgs.back() == "lexer" ? ExtractionEngine::Lexer : ExtractionEngine::AST;
+        }
+        else
+        if (Arg == "--downstream") {
+            Downstream = true;
+        }
+        else
+        if (Arg == "--downstream-tus") {
+            if (StringRef(argv[++i]).getAsInteger(10, Consumers)) {
+                errs() << "Error: --downstream-tus expects a number of files, got " << argv[i] << ".\n";
+                return 1;
+            }
+        }
+        else
+        if (Arg == "--clang") {
+            Clang = argv[++i];
+        }
+        else
+        if (Arg == "--full-traversal") {
+            PhaseArgs.push_back(Arg);
+            FullTraversal = true;
+        }
+        //an unknown option is an error (it would be taken for a .c file)
+        else
+        if (StringRef(Arg).starts_with("-")) {
+            errs() << "Error: Unknown option " << Arg << ".\n";
+            return 1;
+        }
+        else {
+            if (!collectSourceFiles(Arg, SourceFiles)) {
+                return 1;
+            }
+            PhaseArgs.push_back(Arg);
+        }
+    }
+    //a .c file given twice is measured once
+    removeDuplicateSourceFiles(SourceFiles);
+
+    if (SourceFiles.empty()) {
+        errs() << "Error: No source file specified.\n";
+        return 1;
+    }
+
+    //downstream mode: no phases
+    if (Downstream) {
+        if (Clang.empty()) {
+            ErrorOr<std::string> Found = llvm::sys::findProgramByName("clang++");
+            if (!Found) {
+                errs() << "Error: clang++ not found (use --clang).\n";
+                return 1;
+            }
+            Clang = *Found;
+        }
+        if (std::error_code EC = llvm::sys::fs::create_directories(OutDir)) {
+            errs() << "Error: Could not create directory " << OutDir << ": " << EC.message() << "\n";
+            return 1;
+        }
+        return runDownstream(SourceFiles, OutDir, Options, Consumers, Clang);
+    }
+
+    //phase process: run the phase and write its result
+    if (!Phase.empty()) {
+        if (std::error_code EC = llvm::sys::fs::create_directories(OutDir)) {
+            errs() << "Error: Could not create directory " << OutDir << ": " << EC.message() << "\n";
+            return 1;
+        }
+
+        std::atomic<size_t> FunctionCount(0);
+        double WallSeconds = 0;
+        size_t Failed = runPhase(Phase, SourceFiles, OutDir, PCHDir, Options, FullTraversal, Jobs, FunctionCount,
+                                 WallSeconds);
+
+        struct rusage Usage;
+        getrusage(RUSAGE_SELF, &Usage);
+
+        std::error_code EC;
+        raw_fd_ostream ResultFile(ResultFileName, EC);
+        if (EC) {
+            errs() << "Error: Could not write " << ResultFileName << ": " << EC.message() << "\n";
+            return 1;
+        }
+        ResultFile << SourceFiles.size() << " " << FunctionCount << " " << WallSeconds << " " << Usage.ru_maxrss << "\n";
+        return Failed == 0 ? 0 : 1;
+    }
+
+    //bench process: run each phase Repeat times, keep the fastest run
+    std::string BenchExecutable = llvm::sys::fs::getMainExecutable(argv[0], (void *)&runPhase);
+    std::vector<PhaseResult> Results;
+    for (const char *PhaseName : Phases) {
+        std::optional<PhaseResult> Best;
+        for (unsigned r = 0; r < Repeat; ++r) {
+            std::optional<PhaseResult> Result = runPhaseProcess(PhaseName, BenchExecutable, PhaseArgs);
+            if (!Result) {
+                return 1;
+            }
+            if (!Best || Result->WallSeconds < Best->WallSeconds) {
+                Best = Result;
+            }
+        }
+        Results.push_back(*Best);
+    }
+
+    //the number of functions is only counted by the traverse phase: it is the same for all the phases
+    size_t Functions = Results[2].Functions;
+
+    outs() << SourceFiles.size() << " .c files, " << Functions << " functions"
+           << (Options.SkipFunctionBodies ? ", --skip-bodies" : "") << (PCHDir.empty() ? "" : ", --pch-dir")
+           << (FullTraversal ? ", --full-traversal" : "")
+           << (Options.Engine == ExtractionEngine::Lexer ? ", --engine lexer" : "") << "\n\n";
+    outs() << left_justify("phase", 12) << right_justify("wall (s)", 12) << right_justify("phase (s)", 12)
+           << right_justify("TUs/s", 12) << right_justify("functions/s", 14) << right_justify("peak RSS (MB)", 16) << "\n";
+    for (size_t i = 0; i < Results.size(); ++i) {
+        const PhaseResult &R = Results[i];
+        double PhaseSeconds = R.WallSeconds - (i == 0 ? 0 : Results[i - 1].WallSeconds);
+        outs() << left_justify(R.Phase, 12)
+               << right_justify(formatv("{0:F3}", R.WallSeconds).str(), 12)
+               << right_justify(formatv("{0:F3}", PhaseSeconds).str(), 12)
+               << right_justify(formatv("{0:F1}", R.TUs / R.WallSeconds).str(), 12)
+               << right_justify(formatv("{0:F1}", Functions / R.WallSeconds).str(), 14)
+               << right_justify(formatv("{0:F1}", R.PeakRSSKB / 1024.0).str(), 16) << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,3083 @@
+#include "header_generator.h"
+
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Tooling/CommonOptionsParser.h" //to use: clang::tooling::FixedCompilationDatabase
+#include "clang/Tooling/Tooling.h"
+#include "clang/AST/ASTConsumer.h"
+#include "clang/AST/DeclCXX.h" //CXXMethodDecl: skipped by FunctionDeclCollector
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h" //used by the in-memory API
+#include "clang/Basic/FileSystemStatCache.h" //used by --stat-cache
+#include "clang/Basic/SourceManager.h" //used by the lexer engine: SourceManagerForFile
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/PPCallbacks.h" //used by include collector
+#include "clang/Lex/Preprocessor.h" //used by include collector
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSwitch.h" //used by the lexer engine
+#include "llvm/Support/Allocator.h" //used by FunctionDeclCollector
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/FileSystem.h" //used to walk input directories in batch mode
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h" //used by --stats
+#include "llvm/Support/MemoryBuffer.h" //used by the header cache
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h" //used to run one ClangTool per input in parallel
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/TimeProfiler.h" //used by --time-trace
+#include "llvm/Support/xxhash.h" //used by the header cache
+
+#include <algorithm>
+#include <chrono>
+#include <initializer_list>
+
+using namespace clang;
+using namespace clang::tooling;
+using namespace llvm;
+
+namespace headergen {
+
+// serializes the messages printed by the tools running in parallel (batch mode)
+static std::mutex OutputMutex;
+
+// the content of the .h file (or of the .cppm file: EmitModule): the includes, the forward declarations and the
+// declarations (sorted) ; shared by the AST and the lexer engines, so that they write the same file
+static std::string renderHeader(StringRef OutputFile, const std::set<std::string> &Headers,
+                                const std::set<std::string> &ForwardDeclarations, ArrayRef<StringRef> Declarations,
+                                bool EmitModule, bool CPlusPlus);
+
+// writes Content into OutputFile, unless it already has this content ; sets Info.Status (generated or unchanged)
+static Error emitHeader(StringRef OutputFile, StringRef Content, TranslationUnitInfo &Info, const GeneratorOptions &Options);
+
+std::optional<uint64_t> hashFileContent(StringRef Path) {
+    auto Buffer = MemoryBuffer::getFile(Path);
+    if (!Buffer) {
+        return std::nullopt;
+    }
+    return xxh3_64bits(arrayRefFromStringRef((*Buffer)->getBuffer()));
+}
+
+std::string deriveModuleName(StringRef OutputFile) {
+    std::string Name = llvm::sys::path::stem(OutputFile).str();
+    for (char &C : Name) {
+        if (!llvm::isAlnum(C) && C != '_') {
+            C = '_';
+        }
+    }
+    if (Name.empty() || llvm::isDigit(Name[0])) {
+        Name = "m_" + Name;
+    }
+    return Name;
+}
+
+bool isCXXSourceFile(StringRef File) {
+    StringRef Extension = llvm::sys::path::extension(File);
+    return Extension == ".cpp" || Extension == ".cc" || Extension == ".cxx";
+}
+
+
+/*-----------------------------------------------------------------------------------------------*/
+/* classes                                                                             */
+/*-----------------------------------------------------------------------------------------------*/
+
+namespace {
+
+// PhaseTimer : measures a phase of the generation of a .h file: adds its duration (ms) to Total
+// and records it as a span of the Chrome trace (if --time-trace)
+class PhaseTimer {
+private:
+    llvm::TimeTraceScope Span;
+    std::chrono::steady_clock::time_point Start;
+    double &Total;
+
+public:
+    PhaseTimer(StringRef Name, StringRef Detail, double &Total)
+        : Span(Name, Detail), Start(std::chrono::steady_clock::now()), Total(Total) {}
+
+    ~PhaseTimer() {
+        Total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+    }
+};
+
+
+// IncludeCollector : A preprocessor callbacks set that finds and stores all #include directives in its member: RequiredHeaders
+// it also stores the paths of all the files included by the .c file (directly or not) in its member: Info.Dependencies
+// and, if IncludedFiles is given, the files included by the .c file itself with their #include spelling (--minimal-includes)
+// and, if IncludePaths is given, the path of the file each #include of the .c file resolved to (--umbrella)
+class IncludeCollector : public PPCallbacks {
+private:
+    std::set<std::string> &RequiredHeaders;
+    TranslationUnitInfo &Info;
+    const SourceManager &SM;
+    std::map<const FileEntry *, std::string> *IncludedFiles;
+    std::map<std::string, std::string> *IncludePaths;
+
+public:
+    //ctor
+    explicit IncludeCollector(std::set<std::string> &headers, TranslationUnitInfo &Info, const SourceManager &SM,
+                              std::map<const FileEntry *, std::string> *IncludedFiles = nullptr,
+                              std::map<std::string, std::string> *IncludePaths = nullptr)
+        : RequiredHeaders(headers), Info(Info), SM(SM), IncludedFiles(IncludedFiles), IncludePaths(IncludePaths) {}
+
+    // This callback is triggered for every #include directive.
+    // It will be called by the Preprocessor when it encounters an #include.
+    void InclusionDirective(SourceLocation HashLoc,
+                            const Token &IncludeTok,
+                            StringRef FileName,
+                            bool IsAngled,
+                            CharSourceRange FilenameRange,
+                            OptionalFileEntryRef File,
+                            StringRef SearchPath,
+                            StringRef RelativePath,
+                            const clang::Module *SuggestedModule,
+                            bool ModuleImported,
+                            SrcMgr::CharacteristicKind FileType) override {
+        PhaseTimer Timer("IncludeCollector", FileName, Info.IncludeCallbacksMs);
+
+        //every included file is a dependency of the .h file (used by the header cache)
+        if (File) {
+            Info.Dependencies.insert(File->getName().str());
+        }
+
+        if (SM.isInMainFile(HashLoc)) //collect only the includes which # is in the .c file
+        {
+        // Collect the header name in the correct format (<...> or "...").
+        std::string headerStr = IsAngled ? "<" + FileName.str() + ">" : "\"" + FileName.str() + "\"";
+        RequiredHeaders.insert(headerStr);
+        if (IncludedFiles && File) {
+            (*IncludedFiles)[&File->getFileEntry()] = headerStr;
+        }
+        if (IncludePaths && File) {
+            (*IncludePaths)[headerStr] = File->getName().str();
+        }
+        }
+    }
+
+    //--cache: each file entered by the preprocessor (the .c file, the included files) is hashed from the buffer the
+    //parser reads, not from the disk after the parse. the .c file is recorded under its name in Info (the tool
+    //gives the parser an absolute path)
+    void FileChanged(SourceLocation Loc, FileChangeReason Reason, SrcMgr::CharacteristicKind FileType,
+                     FileID PrevFID) override {
+        if (!Info.HashContents || Reason != EnterFile) {
+            return;
+        }
+        FileID FID = SM.getFileID(Loc);
+        OptionalFileEntryRef File = SM.getFileEntryRefForID(FID);
+        if (!File) {
+            return; //<built-in>, <command line>
+        }
+        std::string Name = FID == SM.getMainFileID() ? Info.InputFile : File->getName().str();
+        if (Info.ContentHashes.count(Name)) {
+            return;
+        }
+        if (std::optional<llvm::MemoryBufferRef> Buffer = SM.getBufferOrNone(FID)) {
+            Info.ContentHashes[Name] = xxh3_64bits(arrayRefFromStringRef(Buffer->getBuffer()));
+        }
+    }
+
+    const std::set<std::string>& getHeaders() const {
+        return RequiredHeaders;
+    }
+};
+
+
+// FunctionDeclCollector : an AST visitor that parses the AST of the .c file and:
+//      - collects functions declarations: their strings are stored in the member: Arena, and referenced by the
+//        member: FunctionDeclarations
+//
+// when the (inherited) method: TraverseDecl() is called, it parses the AST and executes 
+// the cb: VisitFunctionDecl() each time it encounters a function declaration. This cb does the processing (aka:
+// populating FunctionDeclarations and RequiredHeaders)
+// members: Context (from Tool), Policy, ExportedOnly, Arena, Saver, FunctionDeclarations, Functions, Sorted,
+//          MainFilePath (from Tool), FormatMs
+class FunctionDeclCollector : public RecursiveASTVisitor<FunctionDeclCollector> {
+private:
+    ASTContext &Context; //AST + other things
+    PrintingPolicy Policy; //how the types are printed: the one of the AST context (source-level type names), adjusted
+                           //by the consumer
+    bool ExportedOnly = false; //--emit-module: only the functions a module can export
+    BumpPtrAllocator Arena; //the declarations strings: freed all at once with the collector
+    StringSaver Saver;
+    std::vector<StringRef> FunctionDeclarations;
+    //the functions and their declarations, in visit order (used by MinimalIncludeFinder and --umbrella)
+    std::vector<std::pair<const FunctionDecl *, StringRef>> Functions;
+    bool Sorted = true;
+    std::string MainFilePath;
+    double FormatMs = 0;
+
+public:
+    //constructor
+    explicit FunctionDeclCollector(ASTContext &Context, StringRef MainFile)
+        : Context(Context), Policy(Context.getPrintingPolicy()), Saver(Arena), MainFilePath(MainFile.str()) {}
+
+    PrintingPolicy &getPrintingPolicy() {
+        return Policy;
+    }
+
+    // --emit-module: the functions that cant be exported by a module are skipped: the ones with internal linkage
+    // (static, anonymous namespace), main, and the inline/constexpr/deleted ones (their declaration alone isnt usable)
+    void setExportedOnly(bool Value) {
+        ExportedOnly = Value;
+    }
+
+    // pruned traversal: called for each top level declaration of the .c file (HeaderGeneratorConsumer::HandleTopLevelDecl
+    // gives it only the declarations of the main file) ; nothing included from another file is walked.
+    // a function is visited without walking its body ; extern "C" {} blocks and namespaces are searched for functions
+    void collectTopLevelDecl(Decl *D) {
+        if (auto *F = dyn_cast<FunctionDecl>(D)) {
+            VisitFunctionDecl(F);
+        }
+        else
+        if (isa<LinkageSpecDecl>(D) || isa<NamespaceDecl>(D)) {
+            for (Decl *Child : cast<DeclContext>(D)->decls()) {
+                collectTopLevelDecl(Child);
+            }
+        }
+    }
+
+    // cb; 
+    // there is an inherited method: Visitor.TraverseDecl(); 
+    // when it's called as Visitor.TraverseDecl(Context.getTranslationUnitDecl()): this cb is executed each time
+    // the visitor (this object) encounters a function declaration in the AST (the whole AST is walked, including
+    // the included files: generate_header_bench --full-traversal uses it to compare with collectTopLevelDecl)
+    bool VisitFunctionDecl(FunctionDecl *F) {
+        // leave the cb if the declaration isnt in MainFile (could be included from another file 
+        // after the preprocessing)
+        if (!Context.getSourceManager().isInMainFile(F->getLocation())) {
+            return true;
+        }
+
+        // a function of an anonymous namespace cant be declared anywhere else
+        if (F->isInAnonymousNamespace()) {
+            return true;
+        }
+
+        // C++: a member function (an out-of-line definition, a constructor) cant be declared outside of its class ;
+        // a template, or a specialization of a template, cant be declared without its template header
+        if (isa<CXXMethodDecl>(F) || F->isTemplated() || F->getTemplateSpecializationKind() != TSK_Undeclared) {
+            return true;
+        }
+        if (ExportedOnly && (!F->isExternallyVisible() || F->isMain() || F->isInlineSpecified() || F->isConstexpr() ||
+                             F->isDeleted())) {
+            return true;
+        }
+
+        PhaseTimer Timer("FormatDecl", MainFilePath, FormatMs);
+
+        const PrintingPolicy &PP = Policy;
+
+        //the declaration is written in a stack buffer (no allocation for most of them), then copied once
+        //in the Arena: its record in FunctionDeclarations is only a pointer and a size
+        SmallString<256> Declaration;
+        raw_svector_ostream OS(Declaration);
+
+        //C++: a function of a namespace is declared in its namespace ("namespace a::b { ... }"), an extern "C"
+        //function with its language linkage
+        const NamespaceDecl *Namespace = nullptr;
+        for (const DeclContext *DC = F->getDeclContext(); DC && !Namespace; DC = DC->getParent()) {
+            Namespace = dyn_cast<NamespaceDecl>(DC);
+        }
+        if (Namespace) {
+            OS << "namespace " << Namespace->getQualifiedNameAsString() << " { ";
+        }
+        bool ExternC = Context.getLangOpts().CPlusPlus && F->isExternC();
+        if (ExternC) {
+            OS << "extern \"C\" ";
+        }
+
+        //storage class can be: static or extern (none after a language linkage)
+        if (!ExternC && F->getStorageClass() == SC_Static) {
+            OS << "static ";
+        }
+        else 
+        if (!ExternC && F->getStorageClass() == SC_Extern)
+        {
+            OS << "extern ";
+        }
+
+        //return type and function name
+        F->getReturnType().print(OS, PP);
+        OS << " " << F->getDeclName() << "(";
+
+        //the params
+        for (unsigned i = 0; i < F->getNumParams(); ++i) 
+        {
+            ParmVarDecl *Param = F->getParamDecl(i);
+            
+            Param->getType().print(OS, PP);
+            if (!Param->getDeclName().isEmpty()) {
+                OS << " " << Param->getDeclName();
+            }
+            if (i < F->getNumParams() - 1) {
+                OS << ", ";
+            }
+        }
+
+        // A function is variadic only if it explicitly has '...' in its declaration.
+        if (F->isVariadic()) {
+            if (F->getNumParams() > 0) {
+                OS << ", ";
+            }
+            OS << "...";
+        }
+        OS << ");";
+        if (Namespace) {
+            OS << " }";
+        }
+
+        FunctionDeclarations.push_back(Saver.save(Declaration.str()));
+        Functions.emplace_back(F, FunctionDeclarations.back());
+        Sorted = false;
+
+        return true;
+    }
+
+    // the declarations, sorted and without duplicates (a function can be declared before being defined):
+    // they are sorted once, when the traversal is done
+    ArrayRef<StringRef> getDeclarations() {
+        if (!Sorted) {
+            llvm::sort(FunctionDeclarations);
+            FunctionDeclarations.erase(std::unique(FunctionDeclarations.begin(), FunctionDeclarations.end()),
+                                       FunctionDeclarations.end());
+            Sorted = true;
+        }
+        return FunctionDeclarations;
+    }
+
+    const std::vector<std::pair<const FunctionDecl *, StringRef>> &getFunctions() const {
+        return Functions;
+    }
+
+    double getFormatMs() const {
+        return FormatMs;
+    }
+
+};
+
+
+// MinimalIncludeFinder : finds the #include lines of the .c file needed by the declarations of the .h file
+// (--minimal-includes):
+//      - a typedef or a struct/union/enum named in a declaration is declared in a file ; the #include line of the .c file
+//        that brings this file (directly or not) is needed
+//      - a struct/union only used through pointers doesnt need its #include line: it is forward declared
+// the builtin types (int, _Bool, ...) need nothing, but "bool" in C: it is a macro (stdbool.h)
+// members: SM, IncludedFiles (from IncludeCollector), BoolMacroLoc, Headers, CompleteTags, PointedTags
+class MinimalIncludeFinder {
+private:
+    const SourceManager &SM;
+    const std::map<const FileEntry *, std::string> &IncludedFiles;
+    SourceLocation BoolMacroLoc; //C: where the macro bool is defined, if the declarations print bool
+    std::set<std::string> Headers;
+    std::set<const TagDecl *> CompleteTags; //the struct/union/enum needed by value
+    std::set<const TagDecl *> PointedTags; //the struct/union used through pointers
+
+    //walks up the include chain of the file declaring D: the outermost file included by the .c file is the one to include.
+    //a declaration loaded from the PCH has the prefix header at the top of its chain, not the .c file: the outermost
+    //file of the chain included by the .c file is also the right one
+    void addDeclaration(const Decl *D) {
+        addLocation(D->getLocation());
+    }
+
+    void addLocation(SourceLocation Loc) {
+        FileID FID = SM.getFileID(SM.getExpansionLoc(Loc));
+        const std::string *Header = nullptr;
+        while (FID.isValid() && FID != SM.getMainFileID()) {
+            if (OptionalFileEntryRef File = SM.getFileEntryRefForID(FID)) {
+                auto Included = IncludedFiles.find(&File->getFileEntry());
+                if (Included != IncludedFiles.end()) {
+                    Header = &Included->second;
+                }
+            }
+            SourceLocation IncludeLoc = SM.getIncludeLoc(FID);
+            if (IncludeLoc.isInvalid()) {
+                break;
+            }
+            FID = SM.getFileID(IncludeLoc);
+        }
+        //a declaration of the .c file itself (or a builtin one) cant be included
+        if (Header) {
+            Headers.insert(*Header);
+        }
+    }
+
+    //the declarations named by a type ; BehindPointer: the type is pointed to (an incomplete struct/union is enough)
+    void addType(QualType T, bool BehindPointer) {
+        if (T.isNull()) {
+            return;
+        }
+        //the typedef name is what the .h file prints: only its own declaration is needed
+        if (const auto *Typedef = T->getAs<TypedefType>()) {
+            addDeclaration(Typedef->getDecl());
+        }
+        else
+        if (const auto *Pointer = T->getAs<PointerType>()) {
+            addType(Pointer->getPointeeType(), true);
+        }
+        else
+        if (const ArrayType *Array = T->getAsArrayTypeUnsafe()) {
+            addType(Array->getElementType(), BehindPointer);
+        }
+        else
+        if (const auto *Function = T->getAs<FunctionType>()) {
+            addFunctionType(Function);
+        }
+        else
+        if (T->isSpecificBuiltinType(BuiltinType::Bool)) {
+            if (BoolMacroLoc.isValid()) {
+                addLocation(BoolMacroLoc);
+            }
+        }
+        else
+        if (const auto *Tag = T->getAs<TagType>()) {
+            //an enum cant be forward declared in C ; an anonymous struct cant be named
+            if (BehindPointer && !isa<EnumDecl>(Tag->getDecl()) && Tag->getDecl()->getIdentifier()) {
+                PointedTags.insert(Tag->getDecl());
+            }
+            else {
+                CompleteTags.insert(Tag->getDecl());
+            }
+        }
+    }
+
+    void addFunctionType(const FunctionType *Function) {
+        addType(Function->getReturnType(), false);
+        if (const auto *Proto = dyn_cast<FunctionProtoType>(Function)) {
+            for (QualType Param : Proto->getParamTypes()) {
+                addType(Param, false);
+            }
+        }
+    }
+
+public:
+    //ctor
+    MinimalIncludeFinder(const SourceManager &SM, const std::map<const FileEntry *, std::string> &IncludedFiles,
+                         SourceLocation BoolMacroLoc)
+        : SM(SM), IncludedFiles(IncludedFiles), BoolMacroLoc(BoolMacroLoc) {}
+
+    void addFunction(const FunctionDecl *F) {
+        addType(F->getReturnType(), false);
+        //the params as written (a DecayedType prints its array type)
+        for (const ParmVarDecl *Param : F->parameters()) {
+            addType(Param->getType(), false);
+        }
+    }
+
+    // the #include lines needed by the declarations (a subset of the #include lines of the .c file)
+    std::set<std::string> getHeaders() {
+        for (const TagDecl *Tag : CompleteTags) {
+            const TagDecl *Definition = Tag->getDefinition();
+            addDeclaration(Definition ? Definition : Tag);
+        }
+        return Headers;
+    }
+
+    // the "struct name;" lines of the struct/union only used through pointers
+    std::set<std::string> getForwardDeclarations() const {
+        std::set<std::string> ForwardDeclarations;
+        for (const TagDecl *Tag : PointedTags) {
+            if (!CompleteTags.count(Tag)) {
+                ForwardDeclarations.insert(Tag->getKindName().str() + " " + Tag->getName().str() + ";");
+            }
+        }
+        return ForwardDeclarations;
+    }
+};
+
+
+// LexerDeclExtractor : the lexer engine (--engine=lexer): finds the #include lines and the functions declarations of a
+// .c file with a raw clang::Lexer, without the preprocessor (the included files arent read) and without the parser.
+// it reads the top level declarations of the form: [static|extern] <type> name(<type> [name], ...) followed by ; or
+// by a body (skipped: only its braces are matched), and formats them as FunctionDeclCollector prints them.
+// a file with something at the top level that could hide or change a function is unsupported (the AST engine
+// generates its .h file): a conditional directive, a macro of the file used in a declaration, a K&R definition,
+// a function pointer, a declarator or a type it cant read, ...
+// for a module (EmitModule) it keeps the functions with external linkage only, as the AST engine does.
+// what it cant see: the macros of the included files used in a declaration, the functions declared with a typedef
+// of a function type (--verify compares the two engines)
+// members: FileName, EmitModule, Macros, Headers, Functions, Declarations, TopLevelDecls, Unsupported, Pending
+class LexerDeclExtractor {
+private:
+    // LexedToken : a token of a top level declaration: its spelling points into the content of the .c file
+    struct LexedToken {
+        tok::TokenKind Kind;
+        StringRef Text;
+        bool is(tok::TokenKind K) const { return Kind == K; }
+        bool isWord(StringRef Word) const { return Kind == tok::raw_identifier && Text == Word; }
+    };
+
+    // FunctionTokens : a function declaration found at the top level, formatted when the whole file is read
+    // (bool: "_Bool" is printed "bool" if the .c file includes stdbool.h)
+    struct FunctionTokens {
+        std::vector<LexedToken> Specifiers; //storage class + return type
+        StringRef Name;
+        std::vector<LexedToken> Params;
+        unsigned Line;
+    };
+
+    std::string FileName;
+    bool EmitModule;
+    std::set<std::string> Macros; //the macros defined by the .c file
+    std::set<std::string> Headers;
+    std::vector<FunctionTokens> Functions;
+    std::vector<std::string> Declarations;
+    size_t TopLevelDecls = 0; //the top level statements read (declarations, definitions), functions or not
+    std::string Unsupported; //why the file isnt supported (empty if it is)
+    Token Pending; //the first token of the line after a directive (or the end of the file)
+    bool HasPending = false;
+
+    //the words of the builtin types and the qualifiers (a raw lexer doesnt know the keywords)
+    static bool isTypeKeyword(StringRef Word) {
+        return StringSwitch<bool>(Word)
+            .Cases("void", "char", "short", "int", "long", "float", "double", "signed", "unsigned", true)
+            .Cases("_Bool", "bool", "struct", "union", "enum", "const", "volatile", "restrict", true)
+            .Cases("__restrict", "__restrict__", "_Complex", "_Atomic", "__int128", true)
+            .Default(false);
+    }
+
+    //the specifiers that FunctionDeclCollector doesnt print
+    static bool isIgnoredSpecifier(StringRef Word) {
+        return StringSwitch<bool>(Word)
+            .Cases("inline", "__inline", "__inline__", "_Noreturn", "__extension__", "register", true)
+            .Default(false);
+    }
+
+    bool unsupported(const Twine &Reason, unsigned Line) {
+        if (Unsupported.empty()) {
+            Unsupported = (Reason + " (line " + Twine(Line) + ")").str();
+        }
+        return false;
+    }
+
+    //the next token that isnt part of a directive ; the directives are read on the way (TopLevel: not in a body).
+    //returns false at the end of the file or if the file isnt supported
+    bool next(Lexer &Lex, const SourceManager &SM, Token &Tok, bool TopLevel) {
+        while (true) {
+            if (HasPending) {
+                Tok = Pending;
+                HasPending = false;
+            }
+            else {
+                Lex.LexFromRawLexer(Tok);
+            }
+            if (Tok.is(tok::eof)) {
+                return false;
+            }
+            if (!Tok.is(tok::hash) || !Tok.isAtStartOfLine()) {
+                return true;
+            }
+            if (!readDirective(Lex, SM, TopLevel)) {
+                return false;
+            }
+        }
+    }
+
+    //a directive: its tokens are read until the first token of the next line (kept in Pending)
+    bool readDirective(Lexer &Lex, const SourceManager &SM, bool TopLevel) {
+        Token NameTok;
+        Lex.LexFromRawLexer(NameTok);
+        if (NameTok.is(tok::eof) || NameTok.isAtStartOfLine()) { //null directive
+            Pending = NameTok;
+            HasPending = true;
+            return true;
+        }
+        unsigned Line = SM.getSpellingLineNumber(NameTok.getLocation());
+        StringRef Directive = NameTok.is(tok::raw_identifier) ? NameTok.getRawIdentifier() : StringRef();
+
+        if (Directive == "include" || Directive == "include_next" || Directive == "import") {
+            //the file name is read from the text: a raw lexer doesnt lex <...> as one token
+            StringRef Rest = SM.getBufferData(SM.getMainFileID()).substr(SM.getFileOffset(NameTok.getEndLoc()));
+            Rest = Rest.substr(0, Rest.find_first_of("\r\n")).ltrim(" \t");
+            char Close = Rest.starts_with("<") ? '>' : Rest.starts_with("\"") ? '"' : 0;
+            size_t End = Close ? Rest.find(Close, 1) : StringRef::npos;
+            if (End == StringRef::npos) {
+                return unsupported("computed #include", Line);
+            }
+            Headers.insert(Rest.substr(0, End + 1).str());
+        }
+        else
+        if (Directive == "define") {
+            Token MacroTok;
+            Lex.LexFromRawLexer(MacroTok);
+            if (MacroTok.is(tok::raw_identifier) && !MacroTok.isAtStartOfLine()) {
+                Macros.insert(MacroTok.getRawIdentifier().str());
+            }
+            else {
+                Pending = MacroTok;
+                HasPending = true;
+                return true;
+            }
+        }
+        else
+        if (TopLevel && StringSwitch<bool>(Directive)
+                            .Cases("if", "ifdef", "ifndef", "elif", "elifdef", "elifndef", "else", "endif", true)
+                            .Default(false)) {
+            //only one of the branches is compiled: the lexer engine would read them all
+            return unsupported("conditional directive #" + Directive, Line);
+        }
+
+        //the rest of the line (a \ at the end of a line continues it: the next token isnt at the start of a line)
+        Token Tok;
+        do {
+            Lex.LexFromRawLexer(Tok);
+        } while (!Tok.is(tok::eof) && !Tok.isAtStartOfLine());
+        Pending = Tok;
+        HasPending = true;
+        return true;
+    }
+
+    //removes the __attribute__((...)) and __declspec(...) of a declaration (FunctionDeclCollector doesnt print them)
+    static std::vector<LexedToken> withoutAttributes(ArrayRef<LexedToken> Tokens) {
+        std::vector<LexedToken> Result;
+        for (size_t i = 0; i < Tokens.size(); ++i) {
+            if ((Tokens[i].isWord("__attribute__") || Tokens[i].isWord("__attribute") || Tokens[i].isWord("__declspec")) &&
+                i + 1 < Tokens.size() && Tokens[i + 1].is(tok::l_paren)) {
+                int Depth = 0;
+                for (++i; i < Tokens.size(); ++i) {
+                    Depth += Tokens[i].is(tok::l_paren) - Tokens[i].is(tok::r_paren);
+                    if (Depth == 0) {
+                        break;
+                    }
+                }
+                continue;
+            }
+            Result.push_back(Tokens[i]);
+        }
+        return Result;
+    }
+
+    enum class StatementKind { Function, Other, Unsupported };
+
+    //a top level statement (its tokens up to ; or to the { of a body): a function declaration or something else
+    StatementKind classify(ArrayRef<LexedToken> Statement, unsigned Line, bool BeforeBody) {
+        std::vector<LexedToken> Tokens = withoutAttributes(Statement);
+        if (Tokens.empty()) {
+            if (BeforeBody) {
+                unsupported("block at the top level", Line);
+                return StatementKind::Unsupported;
+            }
+            return StatementKind::Other;
+        }
+        if (Tokens[0].isWord("typedef") || Tokens[0].isWord("_Static_assert") || Tokens[0].isWord("static_assert")) {
+            return StatementKind::Other;
+        }
+
+        //the declarator of a function: the first top level (...) follows its name
+        size_t Open = 0;
+        while (Open < Tokens.size() && !Tokens[Open].is(tok::l_paren)) {
+            if (Tokens[Open].is(tok::equal)) {
+                return StatementKind::Other; //an initializer
+            }
+            //a struct/union/enum defined in the statement: a variable of this type, not a function returning it
+            if (Tokens[Open].is(tok::l_brace)) {
+                auto IsParen = [](const LexedToken &T) { return T.is(tok::l_paren); };
+                if (llvm::any_of(ArrayRef<LexedToken>(Tokens).drop_front(Open), IsParen)) {
+                    unsupported("function returning a type defined in its declaration", Line);
+                    return StatementKind::Unsupported;
+                }
+                return StatementKind::Other;
+            }
+            Open++;
+        }
+        if (Open == Tokens.size()) {
+            return StatementKind::Other;
+        }
+        if (Open == 0 || !Tokens[Open - 1].is(tok::raw_identifier)) {
+            unsupported("declarator in parentheses", Line);
+            return StatementKind::Unsupported;
+        }
+        StringRef Name = Tokens[Open - 1].Text;
+        if (StringSwitch<bool>(Name)
+                .Cases("sizeof", "_Alignof", "_Alignas", "typeof", "__typeof__", "__typeof", "__asm__", "asm", true)
+                .Default(false)) {
+            return StatementKind::Other;
+        }
+        if (isTypeKeyword(Name)) {
+            unsupported("declarator in parentheses", Line);
+            return StatementKind::Unsupported;
+        }
+
+        size_t Close = Open;
+        for (int Depth = 0; Close < Tokens.size(); ++Close) {
+            Depth += Tokens[Close].is(tok::l_paren) - Tokens[Close].is(tok::r_paren);
+            if (Depth == 0) {
+                break;
+            }
+        }
+        if (Close + 1 != Tokens.size()) {
+            unsupported("declaration of " + Name + " not read", Line);
+            return StatementKind::Unsupported;
+        }
+        if (Open == 1) {
+            unsupported(Name + "(...) without a type", Line); //a macro call, or an implicit int
+            return StatementKind::Unsupported;
+        }
+        for (const LexedToken &Lexed : Tokens) {
+            if (Lexed.is(tok::raw_identifier) && Macros.count(Lexed.Text.str())) {
+                unsupported("macro " + Lexed.Text + " in the declaration of " + Name, Line);
+                return StatementKind::Unsupported;
+            }
+        }
+
+        FunctionTokens Function;
+        Function.Specifiers.assign(Tokens.begin(), Tokens.begin() + Open - 1);
+        Function.Name = Name;
+        Function.Params.assign(Tokens.begin() + Open + 1, Tokens.begin() + Close);
+        Function.Line = Line;
+        Functions.push_back(std::move(Function));
+        return StatementKind::Function;
+    }
+
+    //a type as clang prints it: qualifiers, base type, pointers ("const char *", "unsigned int", "char *const *").
+    //Decayed: an array parameter (one more pointer). returns nothing if the type cant be read
+    std::optional<std::string> formatType(ArrayRef<LexedToken> Tokens, bool Decayed, bool Bool) const {
+        unsigned Const = 0, Volatile = 0;
+        unsigned Signed = 0, Unsigned = 0, Short = 0, Long = 0, Int = 0, Char = 0, Float = 0, Double = 0;
+        std::string Base;
+        size_t i = 0;
+        for (; i < Tokens.size() && !Tokens[i].is(tok::star); ++i) {
+            const LexedToken &Lexed = Tokens[i];
+            if (!Lexed.is(tok::raw_identifier)) {
+                return std::nullopt;
+            }
+            StringRef Word = Lexed.Text;
+            unsigned *Counter = StringSwitch<unsigned *>(Word)
+                                    .Case("const", &Const)
+                                    .Case("volatile", &Volatile)
+                                    .Case("signed", &Signed)
+                                    .Case("unsigned", &Unsigned)
+                                    .Case("short", &Short)
+                                    .Case("long", &Long)
+                                    .Case("int", &Int)
+                                    .Case("char", &Char)
+                                    .Case("float", &Float)
+                                    .Case("double", &Double)
+                                    .Default(nullptr);
+            if (Counter) {
+                (*Counter)++;
+            }
+            else
+            if (Base.empty() && (Word == "void" || Word == "bool" || Word == "_Bool")) {
+                Base = Word == "void" ? "void" : (Bool ? "bool" : Word.str());
+            }
+            else
+            if (Base.empty() && (Word == "struct" || Word == "union" || Word == "enum") && i + 1 < Tokens.size() &&
+                Tokens[i + 1].is(tok::raw_identifier) && !isTypeKeyword(Tokens[i + 1].Text)) {
+                Base = (Word + " " + Tokens[++i].Text).str();
+            }
+            else
+            if (Base.empty() && !isTypeKeyword(Word)) {
+                Base = Word.str(); //a typedef
+            }
+            else {
+                return std::nullopt;
+            }
+        }
+
+        //the builtin types are printed with their canonical spelling (unsigned -> unsigned int, long int -> long)
+        unsigned Words = Signed + Unsigned + Short + Long + Int + Char + Float + Double;
+        if (Words > 0) {
+            if (!Base.empty() || Signed + Unsigned > 1 || Short + Char + Float + Double > 1 || Long > 2 || Int > 1 ||
+                (Long && (Short || Char || Float)) || ((Float || Double) && (Signed || Unsigned || Int))) {
+                return std::nullopt;
+            }
+            std::string Sign = Unsigned ? "unsigned " : "";
+            if (Char) {
+                Base = Unsigned ? "unsigned char" : Signed ? "signed char" : "char";
+            }
+            else
+            if (Float || Double) {
+                Base = Float ? "float" : Long ? "long double" : "double";
+            }
+            else {
+                Base = Sign + (Short ? "short" : Long == 1 ? "long" : Long == 2 ? "long long" : "int");
+            }
+        }
+        if (Base.empty()) {
+            return std::nullopt;
+        }
+
+        std::string Type = (Const ? "const " : "") + std::string(Volatile ? "volatile " : "") + Base;
+        //the pointers: each * with its qualifiers
+        std::vector<std::string> Pointers;
+        for (; i < Tokens.size(); ++i) {
+            if (Tokens[i].is(tok::star)) {
+                Pointers.push_back("*");
+                continue;
+            }
+            StringRef Word = Tokens[i].is(tok::raw_identifier) ? Tokens[i].Text : StringRef();
+            if (Word == "const" || Word == "volatile") {
+                Pointers.back() += Word.str() + " ";
+            }
+            else
+            if (Word == "restrict" || Word == "__restrict" || Word == "__restrict__") {
+                Pointers.back() += EmitModule ? "__restrict " : "restrict ";
+            }
+            else {
+                return std::nullopt;
+            }
+        }
+        if (Decayed) {
+            Pointers.push_back("*");
+        }
+        if (!Pointers.empty()) {
+            Type += " ";
+            for (size_t p = 0; p < Pointers.size(); ++p) {
+                //"*const *": a space between a qualifier and the next *, none at the end
+                Type += p + 1 < Pointers.size() ? Pointers[p] : StringRef(Pointers[p]).rtrim().str();
+            }
+        }
+        return Type;
+    }
+
+    //a declaration as FunctionDeclCollector prints it: [static |extern ]<type> name(<type> name, ...);
+    //(a parameter without name: its type alone ; no parameter or (void): "()")
+    std::optional<std::string> formatFunction(const FunctionTokens &Function, bool Bool) const {
+        std::string Declaration;
+        std::vector<LexedToken> ReturnType;
+        for (const LexedToken &Lexed : Function.Specifiers) {
+            if ((Lexed.isWord("static") || Lexed.isWord("extern")) && Declaration.empty()) {
+                Declaration = (Lexed.Text + " ").str();
+            }
+            else
+            if (!Lexed.is(tok::raw_identifier) || !isIgnoredSpecifier(Lexed.Text)) {
+                ReturnType.push_back(Lexed);
+            }
+        }
+        std::optional<std::string> Return = formatType(ReturnType, false, Bool);
+        if (!Return) {
+            return std::nullopt;
+        }
+        Declaration += *Return + " " + Function.Name.str() + "(";
+
+        //the parameters, split on the commas (a parameter with parentheses: a function pointer, isnt read)
+        std::vector<std::vector<LexedToken>> Params(1);
+        for (const LexedToken &Lexed : withoutAttributes(Function.Params)) {
+            if (Lexed.is(tok::l_paren) || Lexed.is(tok::r_paren)) {
+                return std::nullopt;
+            }
+            if (Lexed.is(tok::comma)) {
+                Params.emplace_back();
+            }
+            else
+            if (!Lexed.is(tok::raw_identifier) || !isIgnoredSpecifier(Lexed.Text)) {
+                Params.back().push_back(Lexed);
+            }
+        }
+        if (Params.size() == 1 && (Params[0].empty() || (Params[0].size() == 1 && Params[0][0].isWord("void")))) {
+            Params.clear();
+        }
+        bool Variadic = !Params.empty() && Params.back().size() == 1 && Params.back()[0].is(tok::ellipsis);
+        if (Variadic) {
+            Params.pop_back();
+        }
+
+        for (size_t p = 0; p < Params.size(); ++p) {
+            ArrayRef<LexedToken> Param = Params[p];
+            //an array parameter (one dimension) is a pointer
+            bool Decayed = false;
+            if (!Param.empty() && Param.back().is(tok::r_square)) {
+                size_t Open = Param.size() - 1;
+                while (Open > 0 && !Param[Open].is(tok::l_square)) {
+                    Open--;
+                }
+                for (size_t b = Open + 1; b + 1 < Param.size(); ++b) {
+                    if (Param[b].is(tok::l_square) || Param[b].is(tok::r_square) ||
+                        (Param[b].is(tok::raw_identifier) && (isTypeKeyword(Param[b].Text) || Param[b].isWord("static")))) {
+                        return std::nullopt;
+                    }
+                }
+                Param = Param.take_front(Open);
+                Decayed = true;
+            }
+            //the name: the last word, if the words before it are a type ("const my_t" is a type without name)
+            StringRef ParamName;
+            std::optional<std::string> Type;
+            if (Param.size() >= 2 && Param.back().is(tok::raw_identifier) && !isTypeKeyword(Param.back().Text) &&
+                !Param[Param.size() - 2].isWord("struct") && !Param[Param.size() - 2].isWord("union") &&
+                !Param[Param.size() - 2].isWord("enum")) {
+                Type = formatType(Param.drop_back(), Decayed, Bool);
+                if (Type) {
+                    ParamName = Param.back().Text;
+                }
+            }
+            if (!Type) {
+                Type = formatType(Param, Decayed, Bool);
+            }
+            if (!Type) {
+                return std::nullopt;
+            }
+            Declaration += *Type;
+            if (!ParamName.empty()) {
+                Declaration += " " + ParamName.str();
+            }
+            if (p + 1 < Params.size()) {
+                Declaration += ", ";
+            }
+        }
+        if (Variadic) {
+            Declaration += Params.empty() ? "..." : ", ...";
+        }
+        Declaration += ");";
+        return Declaration;
+    }
+
+public:
+    //ctor
+    explicit LexerDeclExtractor(StringRef FileName, bool EmitModule) : FileName(FileName.str()), EmitModule(EmitModule) {}
+
+    // reads the .c file: Content is its whole content (null terminated: a MemoryBuffer of the file).
+    // returns false if the file isnt supported (getUnsupported() says why)
+    bool extract(StringRef Content) {
+        SourceManagerForFile SMForFile(FileName, Content);
+        const SourceManager &SM = SMForFile.get();
+        LangOptions LangOpts;
+        LangOpts.C99 = LangOpts.C11 = LangOpts.C17 = true;
+        LangOpts.LineComment = true;
+        LangOpts.Digraphs = true;
+        Lexer Lex(SM.getMainFileID(), SM.getBufferOrFake(SM.getMainFileID()), SM, LangOpts);
+
+        std::vector<LexedToken> Statement;
+        unsigned StatementLine = 0;
+        Token Tok;
+        while (next(Lex, SM, Tok, true)) {
+            unsigned Line = SM.getSpellingLineNumber(Tok.getLocation());
+            if (Statement.empty()) {
+                StatementLine = Line;
+            }
+
+            if (Tok.is(tok::l_brace)) {
+                StatementKind Kind = classify(Statement, StatementLine, true);
+                if (Kind == StatementKind::Unsupported) {
+                    return false;
+                }
+                bool InitializerOrTag = llvm::any_of(Statement, [](const LexedToken &T) {
+                    return T.is(tok::equal) || T.isWord("struct") || T.isWord("union") || T.isWord("enum");
+                });
+                if (Kind == StatementKind::Other && !InitializerOrTag) {
+                    return unsupported("unexpected {", Line);
+                }
+                //the body (or the braces of an initializer, of a struct): only its braces are matched
+                for (int Depth = 1; Depth > 0;) {
+                    if (!next(Lex, SM, Tok, false)) {
+                        return Unsupported.empty() ? unsupported("unbalanced braces", Line) : false;
+                    }
+                    Depth += Tok.is(tok::l_brace) - Tok.is(tok::r_brace);
+                }
+                if (Kind == StatementKind::Function) {
+                    TopLevelDecls++;
+                    Statement.clear();
+                }
+                else {
+                    Statement.push_back({tok::l_brace, "{"});
+                }
+            }
+            else
+            if (Tok.is(tok::semi)) {
+                if (classify(Statement, StatementLine, false) == StatementKind::Unsupported) {
+                    return false;
+                }
+                TopLevelDecls += !Statement.empty();
+                Statement.clear();
+            }
+            else
+            if (Tok.is(tok::r_brace)) {
+                return unsupported("unbalanced braces", Line);
+            }
+            else {
+                if (Tok.needsCleaning()) {
+                    return unsupported("line continuation in a declaration", Line);
+                }
+                Statement.push_back({Tok.getKind(), StringRef(SM.getCharacterData(Tok.getLocation()), Tok.getLength())});
+            }
+        }
+        if (!Unsupported.empty()) {
+            return false;
+        }
+        if (!Statement.empty()) {
+            return unsupported("unterminated declaration", StatementLine);
+        }
+
+        //a module exports the functions with external linkage only (as FunctionDeclCollector::setExportedOnly):
+        //not main, not the inline declarations, not the functions declared static (all their declarations: a
+        //function declared static keeps its internal linkage when it is declared again without static)
+        std::set<StringRef> StaticFunctions;
+        auto HasSpecifier = [](const FunctionTokens &Function, std::initializer_list<StringRef> Words) {
+            return llvm::any_of(Function.Specifiers, [&](const LexedToken &Lexed) {
+                return Lexed.is(tok::raw_identifier) && llvm::is_contained(Words, Lexed.Text);
+            });
+        };
+        if (EmitModule) {
+            for (const FunctionTokens &Function : Functions) {
+                if (HasSpecifier(Function, {"static"})) {
+                    StaticFunctions.insert(Function.Name);
+                }
+            }
+        }
+
+        //"_Bool" is printed "bool" if it is a macro (stdbool.h, included with <> or ""), as FunctionDeclCollector
+        //does ; and for a module
+        bool Bool = EmitModule || llvm::any_of(Headers, [](StringRef Header) {
+                        return Header.drop_front().drop_back() == "stdbool.h";
+                    });
+        for (const FunctionTokens &Function : Functions) {
+            if (EmitModule && (Function.Name == "main" || StaticFunctions.count(Function.Name) ||
+                               HasSpecifier(Function, {"inline", "__inline", "__inline__"}))) {
+                continue;
+            }
+            std::optional<std::string> Declaration = formatFunction(Function, Bool);
+            if (!Declaration) {
+                return unsupported("declaration of " + Function.Name + " not read", Function.Line);
+            }
+            Declarations.push_back(std::move(*Declaration));
+        }
+        return true;
+    }
+
+    const std::set<std::string> &getHeaders() const {
+        return Headers;
+    }
+
+    // the declarations, sorted and without duplicates (as FunctionDeclCollector::getDeclarations)
+    std::vector<StringRef> getDeclarations() {
+        llvm::sort(Declarations);
+        Declarations.erase(std::unique(Declarations.begin(), Declarations.end()), Declarations.end());
+        return std::vector<StringRef>(Declarations.begin(), Declarations.end());
+    }
+
+    size_t getTopLevelDecls() const {
+        return TopLevelDecls;
+    }
+
+    const std::string &getUnsupported() const {
+        return Unsupported;
+    }
+};
+
+
+// HeaderGeneratorConsumer : an AST consumer that :
+//      - collects the includes (IncludeCollector) and the functions declarations (FunctionDeclCollector) of the .c file
+//      - writes them into the .h file, only if the .h file content changed
+// members: Visitor, OutputFilePath (Visitor is a FunctionDeclCollector), CI, RequiredHeaders, IncludedFiles, IncludePaths,
+//          MainFileDecls, Info, Options, Sink (if given: receives the .h file instead of the disk),
+//          Umbrella (if given: receives the declarations instead of a .h file: --umbrella), ParseStart, ParseSpan
+class HeaderGeneratorConsumer : public ASTConsumer {
+private:
+    FunctionDeclCollector Visitor;
+    std::string OutputFilePath;
+    CompilerInstance &CI;
+    std::set<std::string> RequiredHeaders;
+    std::map<const FileEntry *, std::string> IncludedFiles; //--minimal-includes: file -> #include spelling
+    std::map<std::string, std::string> IncludePaths; //--umbrella: #include spelling -> path of the included file
+    std::vector<Decl *> MainFileDecls; //the top level declarations of the .c file, in source order
+    TranslationUnitInfo &Info;
+    const GeneratorOptions &Options;
+    const HeaderSink *Sink;
+    UmbrellaStore *Umbrella;
+    std::chrono::steady_clock::time_point ParseStart;
+    TimeTraceProfilerEntry *ParseSpan = nullptr;
+    bool Parsing = false;
+
+    // reports an error as a compiler error so that Tool.run() fails for this input
+    void reportError(ASTContext &Context, StringRef Message, Error E) {
+        DiagnosticsEngine &Diags = Context.getDiagnostics();
+        unsigned DiagID = Diags.getCustomDiagID(DiagnosticsEngine::Error, "%0 '%1': %2");
+        Diags.Report(DiagID) << Message << OutputFilePath << toString(std::move(E));
+    }
+
+public:
+    //ctor
+    explicit HeaderGeneratorConsumer(CompilerInstance &CI, StringRef MainFile, StringRef OutputFile, TranslationUnitInfo &Info,
+                                     const GeneratorOptions &Options, const HeaderSink *Sink, UmbrellaStore *Umbrella = nullptr)
+        : Visitor(CI.getASTContext(), MainFile), OutputFilePath(OutputFile.str()), CI(CI), Info(Info), Options(Options),
+          Sink(Sink), Umbrella(Umbrella)
+    {
+        // Register the IncludeCollector as a preprocessor callback
+        // This is the correct way to pass ownership of the unique_ptr
+        CI.getPreprocessor().addPPCallbacks(std::make_unique<IncludeCollector>(
+            RequiredHeaders, Info, CI.getSourceManager(), Options.MinimalIncludes ? &IncludedFiles : nullptr,
+            Umbrella ? &IncludePaths : nullptr));
+    }
+
+    // the Parse phase: started by HeaderGeneratorFrontendAction::ExecuteAction, ended when the parser gives the
+    // translation unit (or by the action, if the parse stopped before)
+    void startParse() {
+        Parsing = true;
+        ParseStart = std::chrono::steady_clock::now();
+        if (llvm::timeTraceProfilerEnabled()) {
+            ParseSpan = llvm::timeTraceProfilerBegin("Parse", OutputFilePath);
+        }
+    }
+
+    void endParse() {
+        if (!Parsing) {
+            return;
+        }
+        Parsing = false;
+        Info.ParseMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - ParseStart).count();
+        //ended by its pointer: a span clang left open (a fatal error in an included file) stays below it
+        if (ParseSpan) {
+            llvm::timeTraceProfilerEnd(ParseSpan);
+            ParseSpan = nullptr;
+        }
+    }
+
+    //cb called by the parser for each top level declaration it parses (the declarations of the included files too,
+    //but not the ones loaded from a PCH): they are all counted (DeclsVisited), only the ones of the .c file are kept
+    bool HandleTopLevelDecl(DeclGroupRef Group) override {
+        const SourceManager &SM = CI.getSourceManager();
+        for (Decl *D : Group) {
+            Info.DeclsVisited++;
+            if (SM.isInMainFile(D->getLocation())) {
+                MainFileDecls.push_back(D);
+            }
+        }
+        return true;
+    }
+
+    //this method uses the visitor to collect declarations and store them in the member: FunctionDeclarations
+    //then writes them into a .h file and adds the headerguard
+    void HandleTranslationUnit(ASTContext &Context) override {
+        endParse();
+
+        //the types are printed for the language of the output: "bool" if it is a keyword (C++ output) or a macro
+        //(C with stdbool.h: "_Bool" isnt a C++ keyword, a C++ file couldnt include the .h file), "__restrict" in C++
+        Preprocessor &PP = CI.getPreprocessor();
+        bool CPlusPlus = Context.getLangOpts().CPlusPlus;
+        const MacroInfo *BoolMacro = CPlusPlus ? nullptr : PP.getMacroInfo(PP.getIdentifierInfo("bool"));
+        PrintingPolicy &Policy = Visitor.getPrintingPolicy();
+        Policy.Bool = Policy.Bool || BoolMacro || Options.EmitModule;
+        if (Options.EmitModule) {
+            Policy.Restrict = false;
+        }
+        Visitor.setExportedOnly(Options.EmitModule);
+
+        //only the top level declarations of the .c file are visited: walking the whole translation unit
+        //(Visitor.TraverseDecl(Context.getTranslationUnitDecl())) would walk every declaration of the included
+        //system headers to drop them in VisitFunctionDecl
+        {
+            PhaseTimer Timer("Traverse", OutputFilePath, Info.TraverseMs);
+            for (Decl *D : MainFileDecls) {
+                Visitor.collectTopLevelDecl(D);
+            }
+        }
+        Info.DeclsKept = Visitor.getDeclarations().size();
+        Info.IncludesCollected = RequiredHeaders.size();
+
+        //--minimal-includes: the #include lines of the .c file not needed by the declarations are dropped,
+        //the structs only used through pointers are forward declared
+        std::set<std::string> ForwardDeclarations;
+        if (Options.MinimalIncludes) {
+            MinimalIncludeFinder Finder(CI.getSourceManager(), IncludedFiles,
+                                        BoolMacro && Policy.Bool ? BoolMacro->getDefinitionLoc() : SourceLocation());
+            for (const auto &Function : Visitor.getFunctions()) {
+                Finder.addFunction(Function.first);
+            }
+            std::set<std::string> Headers = Finder.getHeaders();
+            ForwardDeclarations = Finder.getForwardDeclarations();
+            Info.IncludesDropped = RequiredHeaders.size() - Headers.size();
+            RequiredHeaders = std::move(Headers);
+        }
+        Info.FormatMs = Visitor.getFormatMs();
+
+        PhaseTimer Timer("Emit", OutputFilePath, Info.EmitMs);
+
+        //--umbrella: the functions with external linkage (static ones and main excluded) and the includes go to the
+        //umbrella header of the run ; the .c file gets no .h file of its own
+        if (Umbrella) {
+            std::vector<UmbrellaStore::Function> Functions;
+            for (const auto &[F, Declaration] : Visitor.getFunctions()) {
+                if (!F->isExternallyVisible() || F->isMain()) {
+                    continue;
+                }
+                UmbrellaStore::Function Entry;
+                Entry.Key = F->getQualifiedNameAsString();
+                Entry.Declaration = Declaration.str();
+                Entry.InputFile = Info.InputFile;
+                raw_string_ostream SignatureStream(Entry.Signature);
+                F->getType().getCanonicalType().print(SignatureStream, Policy);
+                //C++: the overloads of a function have other parameter types
+                if (CPlusPlus && !F->isExternC()) {
+                    Entry.Key += "(";
+                    for (const ParmVarDecl *Param : F->parameters()) {
+                        Entry.Key += (Param == F->parameters().front() ? "" : ", ") +
+                                     Param->getType().getCanonicalType().getAsString(Policy);
+                    }
+                    Entry.Key += F->isVariadic() ? (F->getNumParams() ? ", ...)" : "...)") : ")";
+                }
+                Functions.push_back(std::move(Entry));
+            }
+            Umbrella->add(RequiredHeaders, IncludePaths, ForwardDeclarations, std::move(Functions));
+            Info.Status = "merged";
+            return;
+        }
+        std::string HeaderContent = renderHeader(OutputFilePath, RequiredHeaders, ForwardDeclarations,
+                                                 Visitor.getDeclarations(), Options.EmitModule, CPlusPlus);
+
+        //in-memory API: the .h file is given to the sink, nothing is written on disk
+        if (Sink) {
+            if (Error SinkError = (*Sink)(OutputFilePath, HeaderContent)) {
+                reportError(Context, "could not emit header", std::move(SinkError));
+                return;
+            }
+            Info.Status = "generated";
+            return;
+        }
+
+        if (Error WriteError = emitHeader(OutputFilePath, HeaderContent, Info, Options)) {
+            reportError(Context, "could not write output file", std::move(WriteError));
+        }
+    }
+};
+
+
+// HeaderGeneratorFrontendAction : an AST Frontend Action that can:
+//      - create an object from class: HeaderGeneratorConsumer (the one that creates the .h file)
+//      - set the compilator to use C17 (a .c file ; a C++ file keeps the C++20 of its flags)
+//      - make the parser skip the functions bodies (if Options.SkipFunctionBodies)
+//      - time the phases of clang (--stats, --time-trace): Setup, from BeginSourceFileAction to ExecuteAction (the
+//        consumer is created and the PCH loaded in between), then Parse, from ExecuteAction to the consumer's
+//        HandleTranslationUnit (preprocessing and parsing: clang preprocesses the .c file while it parses it)
+// members: OutputFilePath, Info (filled with what the tool learns about the .c file), Options, Sink, Umbrella,
+//          Consumer (owned by the compiler instance), SetupStart
+class HeaderGeneratorFrontendAction : public ASTFrontendAction {
+private:
+    std::string OutputFilePath;
+    TranslationUnitInfo &Info;
+    const GeneratorOptions &Options;
+    const HeaderSink *Sink;
+    UmbrellaStore *Umbrella;
+    HeaderGeneratorConsumer *Consumer = nullptr;
+    std::chrono::steady_clock::time_point SetupStart;
+
+public:
+    HeaderGeneratorFrontendAction(StringRef OutputFile, TranslationUnitInfo &Info, const GeneratorOptions &Options,
+                                  const HeaderSink *Sink = nullptr, UmbrellaStore *Umbrella = nullptr)
+        : OutputFilePath(OutputFile.str()), Info(Info), Options(Options), Sink(Sink), Umbrella(Umbrella) {}
+
+    bool BeginSourceFileAction(CompilerInstance &CI) override {
+        SetupStart = std::chrono::steady_clock::now();
+        return ASTFrontendAction::BeginSourceFileAction(CI);
+    }
+
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, StringRef InFile) override {
+        //a C++ file is parsed with the language of its flags (getCompilationFlags(true))
+        if (!isCXXSourceFile(InFile)) {
+            CI.getLangOpts().C17 = true;
+            CI.getLangOpts().CPlusPlus = false;
+        }
+        //the parser is created after the consumer: it reads this option when the AST is built.
+        //a skipped body is only brace-matched by the parser: no statements, no Sema on it
+        CI.getFrontendOpts().SkipFunctionBodies = Options.SkipFunctionBodies;
+        auto NewConsumer = std::make_unique<HeaderGeneratorConsumer>(CI, InFile, OutputFilePath, Info, Options, Sink, Umbrella);
+        Consumer = NewConsumer.get();
+        return NewConsumer;
+    }
+
+    void ExecuteAction() override {
+        Info.SetupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - SetupStart).count();
+        Consumer->startParse();
+        ASTFrontendAction::ExecuteAction();
+        Consumer->endParse();
+    }
+};
+
+
+// HeaderGeneratorFrontendActionFactory : can create a HeaderGeneratorFrontendAction
+// members: OutputFilePath, Info, Options, Sink (--verify: receives the .h file of the AST engine), Umbrella (--umbrella)
+class HeaderGeneratorFrontendActionFactory : public FrontendActionFactory {
+private:
+    std::string OutputFilePath;
+    TranslationUnitInfo &Info;
+    const GeneratorOptions &Options;
+    const HeaderSink *Sink;
+    UmbrellaStore *Umbrella;
+
+public:
+    HeaderGeneratorFrontendActionFactory(StringRef OutputFile, TranslationUnitInfo &Info, const GeneratorOptions &Options,
+                                         const HeaderSink *Sink = nullptr, UmbrellaStore *Umbrella = nullptr)
+        : OutputFilePath(OutputFile.str()), Info(Info), Options(Options), Sink(Sink), Umbrella(Umbrella) {}
+
+    std::unique_ptr<FrontendAction> create() override {
+        return std::make_unique<HeaderGeneratorFrontendAction>(OutputFilePath, Info, Options, Sink, Umbrella);
+    }
+};
+
+
+// PrefixPCHAction : a GeneratePCHAction that:
+//      - writes the PCH into OutputFilePath
+//      - collects the files included by the prefix header in Info.Dependencies (used to know when the PCH is out of date)
+// members: OutputFilePath, Headers, Info
+class PrefixPCHAction : public GeneratePCHAction {
+private:
+    std::string OutputFilePath;
+    std::set<std::string> Headers;
+    TranslationUnitInfo &Info;
+
+public:
+    PrefixPCHAction(StringRef OutputFile, TranslationUnitInfo &Info)
+        : OutputFilePath(OutputFile.str()), Info(Info) {}
+
+    //the preprocessor exists at this point, the PCH writer (ASTConsumer) doesnt exist yet
+    bool BeginSourceFileAction(CompilerInstance &CI) override {
+        CI.getFrontendOpts().OutputFile = OutputFilePath;
+        CI.getPreprocessor().addPPCallbacks(std::make_unique<IncludeCollector>(Headers, Info, CI.getSourceManager()));
+        return GeneratePCHAction::BeginSourceFileAction(CI);
+    }
+};
+
+
+// PrefixPCHActionFactory : can create a PrefixPCHAction
+// members: OutputFilePath, Info
+class PrefixPCHActionFactory : public FrontendActionFactory {
+private:
+    std::string OutputFilePath;
+    TranslationUnitInfo &Info;
+
+public:
+    PrefixPCHActionFactory(StringRef OutputFile, TranslationUnitInfo &Info)
+        : OutputFilePath(OutputFile.str()), Info(Info) {}
+
+    std::unique_ptr<FrontendAction> create() override {
+        return std::make_unique<PrefixPCHAction>(OutputFilePath, Info);
+    }
+};
+
+
+// TraversalConsumer : an AST consumer that only traverses the AST with a FunctionDeclCollector (if Mode isnt None)
+// and counts the collected declarations in FunctionCount (parseAndTraverse)
+// members: Visitor, SM, Mode, MainFileDecls, FunctionCount
+class TraversalConsumer : public ASTConsumer {
+private:
+    FunctionDeclCollector Visitor;
+    const SourceManager &SM;
+    TraversalMode Mode;
+    std::vector<Decl *> MainFileDecls;
+    size_t &FunctionCount;
+
+public:
+    TraversalConsumer(CompilerInstance &CI, StringRef MainFile, TraversalMode Mode, size_t &FunctionCount)
+        : Visitor(CI.getASTContext(), MainFile), SM(CI.getSourceManager()), Mode(Mode), FunctionCount(FunctionCount) {}
+
+    bool HandleTopLevelDecl(DeclGroupRef Group) override {
+        if (Mode == TraversalMode::Pruned) {
+            for (Decl *D : Group) {
+                if (SM.isInMainFile(D->getLocation())) {
+                    MainFileDecls.push_back(D);
+                }
+            }
+        }
+        return true;
+    }
+
+    void HandleTranslationUnit(ASTContext &Context) override {
+        if (Mode == TraversalMode::Pruned) {
+            for (Decl *D : MainFileDecls) {
+                Visitor.collectTopLevelDecl(D);
+            }
+        }
+        else
+        if (Mode == TraversalMode::Full) {
+            Visitor.TraverseDecl(Context.getTranslationUnitDecl());
+        }
+        FunctionCount = Visitor.getDeclarations().size();
+    }
+};
+
+
+// TraversalFrontendAction : builds the AST with the same options as HeaderGeneratorFrontendAction, and gives it to a
+// TraversalConsumer
+// members: Mode, Options, FunctionCount
+class TraversalFrontendAction : public ASTFrontendAction {
+private:
+    TraversalMode Mode;
+    const GeneratorOptions &Options;
+    size_t &FunctionCount;
+
+public:
+    TraversalFrontendAction(TraversalMode Mode, const GeneratorOptions &Options, size_t &FunctionCount)
+        : Mode(Mode), Options(Options), FunctionCount(FunctionCount) {}
+
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, StringRef InFile) override {
+        if (!isCXXSourceFile(InFile)) {
+            CI.getLangOpts().C17 = true;
+            CI.getLangOpts().CPlusPlus = false;
+        }
+        CI.getFrontendOpts().SkipFunctionBodies = Options.SkipFunctionBodies;
+        return std::make_unique<TraversalConsumer>(CI, InFile, Mode, FunctionCount);
+    }
+};
+
+
+// TraversalFrontendActionFactory : can create a TraversalFrontendAction
+// members: Mode, Options, FunctionCount
+class TraversalFrontendActionFactory : public FrontendActionFactory {
+private:
+    TraversalMode Mode;
+    const GeneratorOptions &Options;
+    size_t &FunctionCount;
+
+public:
+    TraversalFrontendActionFactory(TraversalMode Mode, const GeneratorOptions &Options, size_t &FunctionCount)
+        : Mode(Mode), Options(Options), FunctionCount(FunctionCount) {}
+
+    std::unique_ptr<FrontendAction> create() override {
+        return std::make_unique<TraversalFrontendAction>(Mode, Options, FunctionCount);
+    }
+};
+
+} // namespace
+
+
+/*-----------------------------------------------------------------------------------------------*/
+/* HeaderCache                                                                         */
+/*-----------------------------------------------------------------------------------------------*/
+
+std::optional<uint64_t> HeaderCache::hashFile(const std::string &Path) {
+    std::shared_ptr<FileHash> Memo;
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        std::shared_ptr<FileHash> &Slot = FileHashes[Path];
+        if (!Slot) {
+            Slot = std::make_shared<FileHash>();
+        }
+        Memo = Slot;
+    }
+    //outside the lock: the other threads hash other files meanwhile
+    std::call_once(Memo->Once, [&] { Memo->Hash = hashFileContent(Path); });
+    return Memo->Hash;
+}
+
+std::optional<uint64_t> HeaderCache::computeKey(const std::string &InputFile,
+                                                const std::vector<std::string> &CommonDependencies,
+                                                const std::vector<std::string> &Dependencies,
+                                                const std::map<std::string, uint64_t> &ContentHashes) {
+    auto hashOf = [&](const std::string &Path) -> std::optional<uint64_t> {
+        auto It = ContentHashes.find(Path);
+        return It != ContentHashes.end() ? std::optional<uint64_t>(It->second) : hashFile(Path);
+    };
+
+    std::string KeyData = std::to_string(FlagsHash);
+    std::optional<uint64_t> InputHash = hashOf(InputFile);
+    if (!InputHash) {
+        return std::nullopt;
+    }
+    KeyData += ";" + std::to_string(*InputHash);
+
+    for (const std::vector<std::string> *List :
+         std::initializer_list<const std::vector<std::string> *>{&CommonDependencies, &Dependencies}) {
+        for (const std::string &Dependency : *List) {
+            std::optional<uint64_t> Hash = hashOf(Dependency);
+            if (!Hash) {
+                return std::nullopt;
+            }
+            KeyData += ";" + Dependency + "=" + std::to_string(*Hash);
+        }
+    }
+    return xxh3_64bits(arrayRefFromStringRef(KeyData));
+}
+
+HeaderCache::HeaderCache(StringRef CacheFile, const std::vector<std::string> &Flags) : CacheFilePath(CacheFile.str()) {
+    std::string FlagsData;
+    for (const std::string &Flag : Flags) {
+        FlagsData += Flag + "\n";
+    }
+    FlagsHash = xxh3_64bits(arrayRefFromStringRef(FlagsData));
+}
+
+void HeaderCache::load() {
+    auto Buffer = MemoryBuffer::getFile(CacheFilePath);
+    if (!Buffer) {
+        return;
+    }
+
+    SmallVector<StringRef, 0> Lines;
+    (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+    if (Lines.empty() || Lines[0] != "generate_header_cache " + std::to_string(FlagsHash)) {
+        return;
+    }
+
+    for (size_t i = 1; i < Lines.size();) {
+        SmallVector<StringRef, 4> Fields;
+        Lines[i++].split(Fields, '\t');
+        Entry E;
+        unsigned NumDependencies = 0;
+        if (Fields.size() != 4 || Fields[2].getAsInteger(10, E.Key) || Fields[3].getAsInteger(10, NumDependencies) ||
+            i + NumDependencies > Lines.size()) {
+            Entries.clear(); //corrupted cache file: ignore it
+            return;
+        }
+        E.OutputFile = Fields[1].str();
+        for (unsigned d = 0; d < NumDependencies; ++d) {
+            E.Dependencies.push_back(Lines[i++].str());
+        }
+        Entries[Fields[0].str()] = std::move(E);
+    }
+}
+
+void HeaderCache::save() {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Error WriteError = writeToOutput(CacheFilePath, [&](raw_ostream &OS) {
+        OS << "generate_header_cache " << FlagsHash << "\n";
+        for (const auto &[InputFile, E] : Entries) {
+            OS << InputFile << "\t" << E.OutputFile << "\t" << E.Key << "\t" << E.Dependencies.size() << "\n";
+            for (const std::string &Dependency : E.Dependencies) {
+                OS << Dependency << "\n";
+            }
+        }
+        return Error::success();
+    });
+    if (WriteError) {
+        errs() << "Error: Could not write cache file " << CacheFilePath << ": " << toString(std::move(WriteError)) << "\n";
+    }
+}
+
+void HeaderCache::setCommonDependencies(const std::vector<std::string> &Dependencies) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    CommonDependencies = Dependencies;
+}
+
+void HeaderCache::invalidate() {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    FileHashes.clear();
+}
+
+bool HeaderCache::isUpToDate(const std::string &InputFile, const std::string &OutputFile) {
+    Entry E;
+    std::vector<std::string> Common;
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        auto It = Entries.find(InputFile);
+        if (It == Entries.end() || It->second.OutputFile != OutputFile) {
+            return false;
+        }
+        E = It->second;
+        Common = CommonDependencies;
+    }
+    if (!llvm::sys::fs::exists(OutputFile)) {
+        return false;
+    }
+    std::optional<uint64_t> Key = computeKey(InputFile, Common, E.Dependencies, {});
+    return Key && *Key == E.Key;
+}
+
+std::vector<std::string> HeaderCache::getDependencies(const std::string &InputFile) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    std::vector<std::string> Dependencies = CommonDependencies;
+    auto It = Entries.find(InputFile);
+    if (It != Entries.end()) {
+        Dependencies.insert(Dependencies.end(), It->second.Dependencies.begin(), It->second.Dependencies.end());
+    }
+    return Dependencies;
+}
+
+void HeaderCache::update(const std::string &InputFile, const std::string &OutputFile,
+                         const std::set<std::string> &Dependencies, const std::map<std::string, uint64_t> &ContentHashes) {
+    Entry E;
+    E.OutputFile = OutputFile;
+    E.Dependencies.assign(Dependencies.begin(), Dependencies.end());
+    std::vector<std::string> Common;
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Common = CommonDependencies;
+    }
+    std::optional<uint64_t> Key = computeKey(InputFile, Common, E.Dependencies, ContentHashes);
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (!Key) {
+        Entries.erase(InputFile);
+        return;
+    }
+    E.Key = *Key;
+    Entries[InputFile] = std::move(E);
+}
+
+/*-----------------------------------------------------------------------------------------------*/
+/* SharedStatCache                                                                     */
+/*-----------------------------------------------------------------------------------------------*/
+
+class SharedStatCache::Adapter : public FileSystemStatCache {
+private:
+    SharedStatCache &Cache;
+    TranslationUnitInfo &Info;
+
+public:
+    Adapter(SharedStatCache &Cache, TranslationUnitInfo &Info) : Cache(Cache), Info(Info) {}
+
+    std::error_code getStat(StringRef Path, llvm::vfs::Status &Status, bool isFile,
+                            std::unique_ptr<llvm::vfs::File> *F, llvm::vfs::FileSystem &FS) override {
+        return Cache.getStat(Path, Status, isFile, F, FS, Info);
+    }
+};
+
+SharedStatCache::DirectoryState SharedStatCache::checkDirectory(StringRef Dir, llvm::vfs::FileSystem &FS) {
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        auto It = CheckedDirectories.find(Dir);
+        if (It != CheckedDirectories.end()) {
+            return It->second;
+        }
+    }
+    DirectoryChecks++;
+    DirectoryState State;
+    if (llvm::ErrorOr<llvm::vfs::Status> DirStatus = FS.status(Dir)) {
+        State.Exists = true;
+        State.MTime = DirStatus->getLastModificationTime().time_since_epoch().count();
+        State.Device = DirStatus->getUniqueID().getDevice();
+        State.Inode = DirStatus->getUniqueID().getFile();
+    }
+    std::lock_guard<std::mutex> Lock(Mutex);
+    CheckedDirectories[Dir] = State;
+    return State;
+}
+
+std::error_code SharedStatCache::getStat(StringRef Path, llvm::vfs::Status &Status, bool isFile,
+                                         std::unique_ptr<llvm::vfs::File> *F, llvm::vfs::FileSystem &FS,
+                                         TranslationUnitInfo &Info) {
+    Lookups++;
+    Info.StatCalls++;
+    //the key is the absolute path (working directory of the tool): the cache file can be used from another directory
+    SmallString<256> Key(Path);
+    FS.makeAbsolute(Key);
+    llvm::sys::path::remove_dots(Key, true);
+    StringRef Dir = llvm::sys::path::parent_path(Key);
+
+    std::optional<DirectoryState> MissingIn;
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        auto FoundIt = Found.find(Key);
+        if (FoundIt != Found.end() && !(isFile && F)) {
+            Status = llvm::vfs::Status::copyWithNewName(FoundIt->second, Path);
+            Saved++;
+            Info.StatCallsSaved++;
+            return std::error_code();
+        }
+        auto MissingIt = Missing.find(Key);
+        if (MissingIt != Missing.end()) {
+            MissingIn = MissingIt->second;
+        }
+    }
+    if (MissingIn) {
+        if (checkDirectory(Dir, FS) == *MissingIn) {
+            Saved++;
+            Info.StatCallsSaved++;
+            return std::make_error_code(std::errc::no_such_file_or_directory);
+        }
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Missing.erase(Key);
+    }
+
+    std::error_code EC;
+    if (!isFile || !F) {
+        llvm::ErrorOr<llvm::vfs::Status> FileStatus = FS.status(Path);
+        if (FileStatus) {
+            Status = *FileStatus;
+        }
+        EC = FileStatus.getError();
+    }
+    else {
+        llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> File = FS.openFileForRead(Path);
+        if (File) {
+            llvm::ErrorOr<llvm::vfs::Status> FileStatus = (*File)->status();
+            if (FileStatus) {
+                Status = *FileStatus;
+                *F = std::move(*File);
+            }
+            EC = FileStatus.getError();
+        }
+        else {
+            EC = File.getError();
+        }
+    }
+
+    if (!EC) {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Found[Key] = Status;
+    }
+    else
+    if (EC == std::errc::no_such_file_or_directory) {
+        DirectoryState State = checkDirectory(Dir, FS);
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Missing[Key] = State;
+    }
+    return EC;
+}
+
+SharedStatCache::SharedStatCache(StringRef CacheFile) : CacheFilePath(CacheFile.str()) {
+}
+
+std::unique_ptr<FileSystemStatCache> SharedStatCache::createAdapter(TranslationUnitInfo &Info) {
+    return std::make_unique<Adapter>(*this, Info);
+}
+
+void SharedStatCache::load() {
+    auto Buffer = MemoryBuffer::getFile(CacheFilePath);
+    if (!Buffer) {
+        return;
+    }
+
+    SmallVector<StringRef, 0> Lines;
+    (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+    if (Lines.empty() || Lines[0] != "generate_header_stat_cache 1") {
+        return;
+    }
+    std::lock_guard<std::mutex> Lock(Mutex);
+    for (size_t i = 1; i < Lines.size(); ++i) {
+        SmallVector<StringRef, 5> Fields;
+        Lines[i].split(Fields, '\t');
+        DirectoryState State;
+        unsigned Exists = 0;
+        if (Fields.size() != 5 || Fields[1].getAsInteger(10, Exists) || Fields[2].getAsInteger(10, State.MTime) ||
+            Fields[3].getAsInteger(10, State.Device) || Fields[4].getAsInteger(10, State.Inode)) {
+            Missing.clear(); //corrupted cache file: ignore it
+            return;
+        }
+        State.Exists = Exists != 0;
+        Missing[Fields[0]] = State;
+    }
+}
+
+void SharedStatCache::save() {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Error WriteError = writeToOutput(CacheFilePath, [&](raw_ostream &OS) {
+        OS << "generate_header_stat_cache 1\n";
+        for (const auto &Entry : Missing) {
+            const DirectoryState &State = Entry.second;
+            OS << Entry.first() << "\t" << (State.Exists ? 1 : 0) << "\t" << State.MTime << "\t" << State.Device
+               << "\t" << State.Inode << "\n";
+        }
+        return Error::success();
+    });
+    if (WriteError) {
+        errs() << "Error: Could not write stat cache file " << CacheFilePath << ": " << toString(std::move(WriteError))
+               << "\n";
+    }
+}
+
+void SharedStatCache::invalidate() {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Found.clear();
+    CheckedDirectories.clear();
+}
+
+void SharedStatCache::printSummary(raw_ostream &OS) const {
+    size_t SyscallsSaved = Saved > DirectoryChecks ? Saved - DirectoryChecks : 0;
+    OS << formatv("stat cache: {0} lookups, {1} answered by the cache, {2} directory checks: {3} syscalls saved\n",
+                  Lookups.load(), Saved.load(), DirectoryChecks.load(), SyscallsSaved);
+}
+
+/*-----------------------------------------------------------------------------------------------*/
+/* UmbrellaStore                                                                       */
+/*-----------------------------------------------------------------------------------------------*/
+
+std::optional<std::string> UmbrellaStore::relativePath(StringRef Path, StringRef Dir) {
+    auto PathIt = llvm::sys::path::begin(Path), PathEnd = llvm::sys::path::end(Path);
+    for (auto DirIt = llvm::sys::path::begin(Dir), DirEnd = llvm::sys::path::end(Dir); DirIt != DirEnd; ++DirIt) {
+        if (PathIt == PathEnd || *PathIt != *DirIt) {
+            return std::nullopt;
+        }
+        ++PathIt;
+    }
+    SmallString<256> Relative;
+    for (; PathIt != PathEnd; ++PathIt) {
+        llvm::sys::path::append(Relative, *PathIt);
+    }
+    if (Relative.empty()) {
+        return std::nullopt;
+    }
+    return llvm::sys::path::convert_to_slash(Relative);
+}
+
+std::string UmbrellaStore::rebaseInclude(StringRef Header,
+                                         const std::map<std::string, std::string> &IncludePaths) const {
+    auto Resolved = IncludePaths.find(Header.str());
+    if (!Header.starts_with("\"") || Resolved == IncludePaths.end()) {
+        return Header.str();
+    }
+    SmallString<256> Path(Resolved->second);
+    llvm::sys::fs::make_absolute(Path);
+    llvm::sys::path::remove_dots(Path, true);
+    for (StringRef Dir : {StringRef(UmbrellaDir), StringRef(CurrentDir)}) {
+        if (std::optional<std::string> Relative = relativePath(Path, Dir)) {
+            return "\"" + *Relative + "\"";
+        }
+    }
+    return "\"" + llvm::sys::path::convert_to_slash(Path) + "\"";
+}
+
+UmbrellaStore::UmbrellaStore(StringRef UmbrellaFile) : UmbrellaFilePath(UmbrellaFile.str()) {
+    SmallString<256> Dir(UmbrellaFile);
+    llvm::sys::fs::make_absolute(Dir);
+    llvm::sys::path::remove_dots(Dir, true);
+    llvm::sys::path::remove_filename(Dir);
+    UmbrellaDir = Dir.str().str();
+    SmallString<256> Current;
+    if (!llvm::sys::fs::current_path(Current)) {
+        CurrentDir = Current.str().str();
+    }
+}
+
+void UmbrellaStore::add(const std::set<std::string> &FileHeaders,
+                        const std::map<std::string, std::string> &IncludePaths,
+                        const std::set<std::string> &FileForwardDeclarations, std::vector<Function> Functions) {
+    for (Function &F : Functions) {
+        Shard &S = Shards[xxh3_64bits(arrayRefFromStringRef(F.Key)) % ShardCount];
+        std::lock_guard<std::mutex> Lock(S.Mutex);
+        S.Functions[F.Key].push_back(std::move(F));
+    }
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    for (const std::string &Header : FileHeaders) {
+        Headers.insert(rebaseInclude(Header, IncludePaths));
+    }
+    ForwardDeclarations.insert(FileForwardDeclarations.begin(), FileForwardDeclarations.end());
+}
+
+/*-----------------------------------------------------------------------------------------------*/
+/* PrecompiledPrefix                                                                   */
+/*-----------------------------------------------------------------------------------------------*/
+
+// the stamp of a file in a deps file: its size and mtime (ns), or nothing if it doesnt exist
+static std::optional<std::pair<uint64_t, int64_t>> statFile(StringRef Path) {
+    llvm::sys::fs::file_status Status;
+    if (llvm::sys::fs::status(Path, Status)) {
+        return std::nullopt;
+    }
+    return std::make_pair(Status.getSize(), (int64_t)Status.getLastModificationTime().time_since_epoch().count());
+}
+
+bool PrecompiledPrefix::isUpToDate() {
+    auto Buffer = MemoryBuffer::getFile(DepsFilePath);
+    if (!Buffer || !llvm::sys::fs::exists(PCHFilePath)) {
+        return false;
+    }
+
+    SmallVector<StringRef, 0> Lines;
+    (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+    std::vector<std::string> RecordedDependencies;
+    std::string Restamped; //the deps file with the current stamps
+    raw_string_ostream RestampedOS(Restamped);
+    bool StampsChanged = false;
+    for (StringRef Line : Lines) {
+        SmallVector<StringRef, 4> Fields;
+        Line.split(Fields, '\t', 3);
+        uint64_t Hash = 0;
+        uint64_t Size = 0;
+        int64_t MTime = 0;
+        if (Fields.size() != 4 || Fields[0].getAsInteger(10, Hash) || Fields[1].getAsInteger(10, Size) ||
+            Fields[2].getAsInteger(10, MTime)) {
+            return false; //corrupted deps file, or written by an older version: the PCH is rebuilt
+        }
+        StringRef Path = Fields[3];
+        std::optional<std::pair<uint64_t, int64_t>> Stamp = statFile(Path);
+        if (!Stamp) {
+            return false;
+        }
+        //the file is hashed only if its size or mtime changed ; same content (ex: saved without change): its new
+        //stamp is recorded, the next check doesnt hash it again
+        if (Stamp->first != Size || Stamp->second != MTime) {
+            std::optional<uint64_t> CurrentHash = hashFileContent(Path);
+            if (!CurrentHash || *CurrentHash != Hash) {
+                return false;
+            }
+            StampsChanged = true;
+        }
+        RestampedOS << Hash << "\t" << Stamp->first << "\t" << Stamp->second << "\t" << Path << "\n";
+        RecordedDependencies.push_back(Path.str());
+    }
+    Dependencies = std::move(RecordedDependencies);
+    if (StampsChanged) {
+        Error WriteError = writeToOutput(DepsFilePath, [&](raw_ostream &OS) {
+            OS << Restamped;
+            return Error::success();
+        });
+        consumeError(std::move(WriteError)); //only an optimization: the next check hashes the files again
+    }
+    return true;
+}
+
+PrecompiledPrefix::PrecompiledPrefix(StringRef CacheDir, const std::vector<std::string> &Headers,
+                                     const std::vector<std::string> &Flags)
+    : Headers(Headers) {
+    std::string KeyData;
+    for (const std::string &Flag : Flags) {
+        KeyData += Flag + "\n";
+    }
+    for (const std::string &Header : Headers) {
+        KeyData += "#include " + Header + "\n";
+    }
+    std::string Stem = CacheDir.str() + "/prefix-" + utohexstr(xxh3_64bits(arrayRefFromStringRef(KeyData)));
+    PrefixFilePath = Stem + ".h";
+    PCHFilePath = Stem + ".pch";
+    DepsFilePath = Stem + ".deps";
+}
+
+std::vector<std::string> PrecompiledPrefix::scanLeadingSystemHeaders(const std::string &SourceFile) {
+    std::vector<std::string> Found;
+    auto Buffer = MemoryBuffer::getFile(SourceFile);
+    if (!Buffer) {
+        return Found;
+    }
+
+    SmallVector<StringRef, 0> Lines;
+    (*Buffer)->getBuffer().split(Lines, '\n');
+    bool InComment = false;
+    for (StringRef Line : Lines) {
+        //the block comments at the start of the line are removed: the code after them is scanned (/* ... */ int x;
+        //ends the prefix) ; the line is skipped only if nothing is left
+        while (true) {
+            if (InComment) {
+                size_t End = Line.find("*/");
+                if (End == StringRef::npos) {
+                    Line = StringRef();
+                    break;
+                }
+                Line = Line.drop_front(End + 2);
+                InComment = false;
+            }
+            Line = Line.trim();
+            if (!Line.consume_front("/*")) {
+                break;
+            }
+            InComment = true;
+        }
+        if (Line.empty() || Line.starts_with("//")) {
+            continue;
+        }
+        if (!Line.consume_front("#")) {
+            break;
+        }
+        Line = Line.ltrim();
+        if (!Line.consume_front("include")) {
+            break;
+        }
+        //#include "...", #include_next, #include MACRO: the end of the prefix
+        Line = Line.ltrim();
+        size_t Close = Line.find('>');
+        if (!Line.starts_with("<") || Close == StringRef::npos) {
+            break;
+        }
+        Found.push_back(Line.take_front(Close + 1).str());
+    }
+    return Found;
+}
+
+bool PrecompiledPrefix::canBeUsedBy(const std::vector<std::string> &LeadingHeaders) const {
+    return LeadingHeaders.size() >= Headers.size() && std::equal(Headers.begin(), Headers.end(), LeadingHeaders.begin());
+}
+
+bool PrecompiledPrefix::prepare(const std::vector<std::string> &Flags) {
+    if (isUpToDate()) {
+        return true;
+    }
+
+    //the prefix header is only written when the PCH is built: it must not be newer than the PCH
+    Error WriteError = writeToOutput(PrefixFilePath, [&](raw_ostream &OS) {
+        for (const std::string &Header : Headers) {
+            OS << "#include " << Header << "\n";
+        }
+        return Error::success();
+    });
+    if (WriteError) {
+        errs() << "Error: Could not write " << PrefixFilePath << ": " << toString(std::move(WriteError)) << "\n";
+        return false;
+    }
+
+    //same flags as the .c files: the PCH must be built with the same language options ;
+    //"-x c-header" is after "-x c": it wins
+    std::vector<std::string> PCHFlags = Flags;
+    PCHFlags.push_back("-x");
+    PCHFlags.push_back("c-header");
+    clang::tooling::FixedCompilationDatabase PCHCompilations(".", PCHFlags);
+    clang::tooling::ClangTool Tool(PCHCompilations, {PrefixFilePath});
+
+    TranslationUnitInfo PCHInfo;
+    if (Tool.run(std::make_unique<PrefixPCHActionFactory>(PCHFilePath, PCHInfo).get()) != 0) {
+        errs() << "Error: Could not build the PCH " << PCHFilePath << "\n";
+        return false;
+    }
+
+    Dependencies.assign(PCHInfo.Dependencies.begin(), PCHInfo.Dependencies.end());
+    Dependencies.push_back(PrefixFilePath);
+    WriteError = writeToOutput(DepsFilePath, [&](raw_ostream &OS) {
+        for (const std::string &Dependency : Dependencies) {
+            //stamp before hash: a file changed in between gets a new stamp, and is hashed by the next check
+            std::pair<uint64_t, int64_t> Stamp = statFile(Dependency).value_or(std::make_pair(0, 0));
+            OS << hashFileContent(Dependency).value_or(0) << "\t" << Stamp.first << "\t" << Stamp.second << "\t"
+               << Dependency << "\n";
+        }
+        return Error::success();
+    });
+    if (WriteError) {
+        errs() << "Error: Could not write " << DepsFilePath << ": " << toString(std::move(WriteError)) << "\n";
+        return false;
+    }
+
+    outs() << "Built the PCH " << PCHFilePath << " (" << Headers.size() << " headers).\n";
+    return true;
+}
+
+std::vector<std::string> PrecompiledPrefix::getFlags(const std::vector<std::string> &Flags) const {
+    std::vector<std::string> PCHFlags = Flags;
+    PCHFlags.insert(PCHFlags.end(), {"-include-pch", PCHFilePath, "-Xclang", "-fno-validate-pch"});
+    return PCHFlags;
+}
+
+const std::vector<std::string> &PrecompiledPrefix::getDependencies() const {
+    return Dependencies;
+}
+
+/*-----------------------------------------------------------------------------------------------*/
+/* StatsCollector                                                                      */
+/*-----------------------------------------------------------------------------------------------*/
+
+void StatsCollector::add(const TranslationUnitInfo &Info) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Infos.push_back(Info);
+}
+
+
+/*-----------------------------------------------------------------------------------------------*/
+/* helpers                                                                             */
+/*-----------------------------------------------------------------------------------------------*/
+
+// the compilation flags of the .c files (or of the C++ files)
+std::vector<std::string> getCompilationFlags(bool CPlusPlus) {
+    //fixed compilation flags: "-x", "c" : treat code as C code ("-x", "c++": as C++20 code)
+    //-I: added include paths for standard C++ headers
+    std::vector<std::string> Flags = {"-std=c17", "-x", "c", "-I/usr/include/c++/17", "-I/usr/include/x86_64-linux-gnu/c++/17", "-I/usr/include"};
+    if (CPlusPlus) {
+        Flags[0] = "-std=c++20";
+        Flags[2] = "c++";
+    }
+    Flags.push_back("-I.");
+    return Flags;
+}
+
+// PCH: precompile the system headers that at least half of the .c files include first, in the same order ; the
+// .c files that start with these includes are compiled with the PCH, the others without it. the PCH is built with
+// the C flags: the C++ files never use it, and dont count in the half
+std::unique_ptr<PrecompiledPrefix> preparePrecompiledPrefix(StringRef PCHDir, const std::vector<std::string> &SourceFiles,
+                                                            const std::vector<std::string> &Flags, std::vector<bool> &UsesPrefix) {
+    std::vector<std::vector<std::string>> LeadingHeaders(SourceFiles.size());
+    std::vector<size_t> Matching;
+    for (size_t i = 0; i < SourceFiles.size(); ++i) {
+        if (!isCXXSourceFile(SourceFiles[i])) {
+            LeadingHeaders[i] = PrecompiledPrefix::scanLeadingSystemHeaders(SourceFiles[i]);
+            Matching.push_back(i);
+        }
+    }
+    size_t CSourceCount = Matching.size();
+
+    //the common prefix is extended one header at a time: with the next header of most of the .c files that start
+    //with it (Matching), as long as they are at least half of the .c files
+    std::vector<std::string> CommonHeaders;
+    while (true) {
+        std::map<std::string, std::vector<size_t>> NextHeaders;
+        for (size_t i : Matching) {
+            if (LeadingHeaders[i].size() > CommonHeaders.size()) {
+                NextHeaders[LeadingHeaders[i][CommonHeaders.size()]].push_back(i);
+            }
+        }
+        auto Best = NextHeaders.end();
+        for (auto It = NextHeaders.begin(); It != NextHeaders.end(); ++It) {
+            if (Best == NextHeaders.end() || It->second.size() > Best->second.size()) {
+                Best = It;
+            }
+        }
+        if (Best == NextHeaders.end() || 2 * Best->second.size() < CSourceCount) {
+            break;
+        }
+        CommonHeaders.push_back(Best->first);
+        Matching = std::move(Best->second);
+    }
+    if (CommonHeaders.empty()) {
+        return nullptr;
+    }
+
+    std::error_code EC = llvm::sys::fs::create_directories(PCHDir);
+    if (EC) {
+        errs() << "Error: Could not create directory " << PCHDir << ": " << EC.message() << "\n";
+        return nullptr;
+    }
+
+    auto Prefix = std::make_unique<PrecompiledPrefix>(PCHDir, CommonHeaders, Flags);
+    if (!Prefix->prepare(Flags)) {
+        return nullptr;
+    }
+    UsesPrefix.assign(SourceFiles.size(), false);
+    for (size_t i = 0; i < SourceFiles.size(); ++i) {
+        UsesPrefix[i] = !isCXXSourceFile(SourceFiles[i]) && Prefix->canBeUsedBy(LeadingHeaders[i]);
+    }
+    return Prefix;
+}
+
+// derives the .h file name from the .c file name: my_file.c -> my_file.h
+std::string deriveHeaderFileName(const std::string &InputFile) {
+    size_t dot_pos = InputFile.rfind('.');
+    if (dot_pos != std::string::npos) {
+        return InputFile.substr(0, dot_pos) + ".h";
+    }
+    return InputFile + ".h";
+}
+
+std::string deriveOutputFileName(const std::string &InputFile, const GeneratorOptions &Options) {
+    std::string HFileName = deriveHeaderFileName(InputFile);
+    if (Options.EmitModule) {
+        return HFileName.substr(0, HFileName.size() - 2) + ".cppm";
+    }
+    return HFileName;
+}
+
+// writes a depfile: "Target: Prerequisites..." (one prerequisite per line)
+bool writeDepfile(StringRef DepfileName, StringRef Target, const std::vector<std::string> &Prerequisites) {
+    //a space or a '#' is escaped with a backslash, a '$' with a '$' (Make variables)
+    auto writePath = [](raw_ostream &OS, StringRef Path) {
+        for (char C : Path) {
+            if (C == ' ' || C == '#') {
+                OS << '\\';
+            }
+            else
+            if (C == '$') {
+                OS << '$';
+            }
+            OS << C;
+        }
+    };
+
+    Error WriteError = writeToOutput(DepfileName, [&](raw_ostream &OS) {
+        writePath(OS, Target);
+        OS << ":";
+        for (const std::string &Prerequisite : Prerequisites) {
+            OS << " \\\n  ";
+            writePath(OS, Prerequisite);
+        }
+        OS << "\n";
+        return Error::success();
+    });
+    if (WriteError) {
+        errs() << "Error: Could not write the depfile " << DepfileName << ": " << toString(std::move(WriteError)) << "\n";
+        return false;
+    }
+    return true;
+}
+
+// adds InputPath to SourceFiles ; if InputPath is a directory: adds all the .c files found in it (recursively)
+// returns false if InputPath can't be read
+bool collectSourceFiles(const std::string &InputPath, std::vector<std::string> &SourceFiles) {
+    if (!llvm::sys::fs::is_directory(InputPath)) {
+        SourceFiles.push_back(InputPath);
+        return true;
+    }
+
+    std::vector<std::string> Found;
+    std::error_code EC;
+    for (llvm::sys::fs::recursive_directory_iterator It(InputPath, EC), End; It != End && !EC; It.increment(EC)) {
+        if (It->type() == llvm::sys::fs::file_type::regular_file && llvm::sys::path::extension(It->path()) == ".c") {
+            Found.push_back(It->path());
+        }
+    }
+    if (EC) {
+        llvm::errs() << "Error: Could not read directory " << InputPath << ": " << EC.message() << "\n";
+        return false;
+    }
+
+    //sort the files so that the run order (and the report) doesnt depend on the directory order
+    std::sort(Found.begin(), Found.end());
+    SourceFiles.insert(SourceFiles.end(), Found.begin(), Found.end());
+    return true;
+}
+
+void removeDuplicateSourceFiles(std::vector<std::string> &SourceFiles) {
+    std::set<std::string> Seen;
+    std::vector<std::string> Unique;
+    for (std::string &File : SourceFiles) {
+        //real_path also resolves the symbolic links ; a missing file (the parser reports it) is made absolute
+        SmallString<256> Key;
+        if (llvm::sys::fs::real_path(File, Key)) {
+            Key = File;
+            llvm::sys::fs::make_absolute(Key);
+            llvm::sys::path::remove_dots(Key, true);
+        }
+        if (Seen.insert(Key.str().str()).second) {
+            Unique.push_back(std::move(File));
+        }
+    }
+    SourceFiles = std::move(Unique);
+}
+
+// renderHeader : the .h file is first generated in memory: it is compared with the existing .h file before being
+// written (in a single write). its size is known: the buffer is allocated once
+static std::string renderHeader(StringRef OutputFile, const std::set<std::string> &Headers,
+                                const std::set<std::string> &ForwardDeclarations, ArrayRef<StringRef> Declarations,
+                                bool EmitModule, bool CPlusPlus) {
+    size_t HeaderSize = 3 * OutputFile.size() + 64;
+    for (const auto &header : Headers) {
+        HeaderSize += header.size() + 10;
+    }
+    for (StringRef Declaration : Declarations) {
+        HeaderSize += Declaration.size() + 1;
+    }
+    for (const auto &ForwardDeclaration : ForwardDeclarations) {
+        HeaderSize += ForwardDeclaration.size() + 1;
+    }
+    std::string HeaderContent;
+    HeaderContent.reserve(HeaderSize);
+    raw_string_ostream HeaderFile(HeaderContent);
+
+    std::string HeaderGuard = OutputFile.str();
+    std::transform(HeaderGuard.begin(), HeaderGuard.end(), HeaderGuard.begin(), ::toupper);
+    std::replace(HeaderGuard.begin(), HeaderGuard.end(), '.', '_');
+    std::replace(HeaderGuard.begin(), HeaderGuard.end(), '-', '_');
+    std::replace(HeaderGuard.begin(), HeaderGuard.end(), '/', '_');
+    std::replace(HeaderGuard.begin(), HeaderGuard.end(), '\\', '_');
+    HeaderGuard += "_";
+
+    //--emit-module: a module interface unit: the #include lines and the forward declarations are in the global
+    //module fragment (they arent part of the module), then the declarations are exported by the module ;
+    //the functions of a .c file keep their C language linkage
+    if (EmitModule) {
+        HeaderFile << "module;\n\n";
+    }
+    else {
+        HeaderFile << "#ifndef " << HeaderGuard << "\n";
+        HeaderFile << "#define " << HeaderGuard << "\n\n";
+    }
+
+    //write all the collected headers from the .c in the .h
+    for (const auto &header : Headers)
+    {
+        HeaderFile << "#include " << header << "\n";
+    }
+
+    HeaderFile << "\n";
+
+    if (!ForwardDeclarations.empty()) {
+        for (const auto &ForwardDeclaration : ForwardDeclarations) {
+            HeaderFile << ForwardDeclaration << "\n";
+        }
+        HeaderFile << "\n";
+    }
+
+    if (EmitModule) {
+        HeaderFile << "export module " << deriveModuleName(OutputFile) << ";\n\n";
+        HeaderFile << (CPlusPlus ? "export {\n" : "export extern \"C\" {\n");
+    }
+
+    for (StringRef Declaration : Declarations) {
+        HeaderFile << Declaration << "\n";
+    }
+
+    if (EmitModule) {
+        HeaderFile << "}\n";
+    }
+    else {
+        HeaderFile << "\n#endif // " << HeaderGuard << "\n";
+    }
+    return HeaderContent;
+}
+
+// emitHeader : same content as the existing .h file: dont touch it, so that its mtime doesnt change and the files
+// including it arent rebuilt
+static Error emitHeader(StringRef OutputFile, StringRef Content, TranslationUnitInfo &Info, const GeneratorOptions &Options) {
+    if (auto Existing = MemoryBuffer::getFile(OutputFile)) {
+        if ((*Existing)->getBuffer() == Content) {
+            Info.Status = "unchanged";
+            std::lock_guard<std::mutex> Lock(OutputMutex);
+            outs() << OutputFile << " is up to date.\n";
+            return Error::success();
+        }
+    }
+
+    //writeToOutput() writes a temporary file and renames it: the .h file is replaced atomically
+    Error WriteError = writeToOutput(OutputFile, [&](raw_ostream &OS) {
+        OS << Content;
+        return Error::success();
+    });
+    if (WriteError) {
+        return WriteError;
+    }
+
+    Info.Status = "generated";
+    std::lock_guard<std::mutex> Lock(OutputMutex);
+    outs() << "Generated " << OutputFile << " successfully";
+    if (Options.MinimalIncludes) {
+        outs() << " (" << Info.IncludesDropped << " of " << Info.IncludesCollected << " includes dropped)";
+    }
+    outs() << ".\n";
+    return Error::success();
+}
+
+// the lexer engine (LexerDeclExtractor) on a .c file: the content of its .h file, or nothing if the engine cant read
+// the file (Info.LexerFallback says why: the AST engine generates it)
+static std::optional<std::string> generateHeaderWithLexer(const std::string &InputFile, const std::string &HFileName,
+                                                          const GeneratorOptions &Options, TranslationUnitInfo &Info) {
+    PhaseTimer Timer("Lex", InputFile, Info.LexMs);
+    auto Buffer = MemoryBuffer::getFile(InputFile);
+    if (!Buffer) {
+        Info.LexerFallback = "could not read the file";
+        return std::nullopt;
+    }
+    LexerDeclExtractor Extractor(InputFile, Options.EmitModule);
+    if (Info.HashContents) {
+        Info.ContentHashes[InputFile] = xxh3_64bits(arrayRefFromStringRef((*Buffer)->getBuffer()));
+    }
+    if (!Extractor.extract((*Buffer)->getBuffer())) {
+        Info.LexerFallback = Extractor.getUnsupported();
+        return std::nullopt;
+    }
+    std::vector<StringRef> Declarations = Extractor.getDeclarations();
+    Info.DeclsVisited = Extractor.getTopLevelDecls();
+    Info.DeclsKept = Declarations.size();
+    Info.IncludesCollected = Extractor.getHeaders().size();
+    return renderHeader(HFileName, Extractor.getHeaders(), {}, Declarations, Options.EmitModule, false);
+}
+
+// --verify: the lines of the .h file of one engine that arent in the .h file of the other one
+static void printEngineDiff(StringRef InputFile, StringRef LexerContent, StringRef ASTContent) {
+    SmallVector<StringRef, 64> LexerLines, ASTLines;
+    LexerContent.split(LexerLines, '\n');
+    ASTContent.split(ASTLines, '\n');
+    std::set<StringRef> LexerSet(LexerLines.begin(), LexerLines.end());
+    std::set<StringRef> ASTSet(ASTLines.begin(), ASTLines.end());
+
+    std::lock_guard<std::mutex> Lock(OutputMutex);
+    errs() << "Warning: the lexer and AST engines disagree on " << InputFile << " (the AST engine is used):\n";
+    for (StringRef Line : LexerLines) {
+        if (!ASTSet.count(Line)) {
+            errs() << "  lexer: " << Line << "\n";
+        }
+    }
+    for (StringRef Line : ASTLines) {
+        if (!LexerSet.count(Line)) {
+            errs() << "  ast:   " << Line << "\n";
+        }
+    }
+}
+
+// runs the HeaderGeneratorFrontendAction on a single .c file and writes the .h file HFileName
+// if a Cache is given: the .c file isnt parsed if its .h file is up to date
+// each call creates its own ClangTool, so it can be called from several threads at the same time
+int generateHeader(const CompilationDatabase &Compilations, const std::string &InputFile, const std::string &HFileName,
+                   const GeneratorOptions &Options, HeaderCache *Cache, StatsCollector *Stats,
+                   UmbrellaStore *Umbrella, SharedStatCache *StatCache) {
+    TranslationUnitInfo Info;
+    Info.InputFile = InputFile;
+    Info.OutputFile = HFileName;
+    Info.HashContents = Cache != nullptr;
+    llvm::TimeTraceScope Span("GenerateHeader", InputFile);
+    auto Start = std::chrono::steady_clock::now();
+    auto addStats = [&] {
+        if (Stats) {
+            Info.TotalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+            Stats->add(Info);
+        }
+    };
+    //-MD: the depfile lists the .c file and all the files it includes (directly or not): a build system reruns the
+    //tool only if one of them changes. it is written each time the tool runs (Ninja deletes it once read)
+    auto writeDepfileOf = [&](const std::vector<std::string> &Dependencies) {
+        std::vector<std::string> Prerequisites = {InputFile};
+        Prerequisites.insert(Prerequisites.end(), Dependencies.begin(), Dependencies.end());
+        std::string DepfileName = Options.DepfileName.empty() ? HFileName + ".d" : Options.DepfileName;
+        return writeDepfile(DepfileName, HFileName, Prerequisites);
+    };
+
+    if (Cache && Cache->isUpToDate(InputFile, HFileName)) {
+        Info.Status = "cached";
+        addStats();
+        if (Options.WriteDepfile && !writeDepfileOf(Cache->getDependencies(InputFile))) {
+            return 1;
+        }
+        std::lock_guard<std::mutex> Lock(OutputMutex);
+        outs() << HFileName << " is up to date (cached).\n";
+        return 0;
+    }
+
+    //--engine=lexer: the .c file is only lexed, unless the lexer engine cant read it ; its .h file depends on the
+    //.c file alone (no included file is read). --verify: the AST engine runs too, and its .h file is written.
+    //the C++ files, --minimal-includes and --umbrella (they need the types of the declarations) always use the AST engine
+    bool UseLexer = (Options.Engine == ExtractionEngine::Lexer || Options.Verify) && !isCXXSourceFile(InputFile) &&
+                    !Options.MinimalIncludes && !Umbrella;
+    std::optional<std::string> LexerContent;
+    if (UseLexer) {
+        LexerContent = generateHeaderWithLexer(InputFile, HFileName, Options, Info);
+        if (!LexerContent) {
+            std::lock_guard<std::mutex> Lock(OutputMutex);
+            outs() << InputFile << ": " << Info.LexerFallback << ", using the AST engine.\n";
+        }
+    }
+    if (LexerContent && !Options.Verify) {
+        Info.Engine = "lexer";
+        int Result = 0;
+        {
+            PhaseTimer Timer("Emit", HFileName, Info.EmitMs);
+            if (Error WriteError = emitHeader(HFileName, *LexerContent, Info, Options)) {
+                std::lock_guard<std::mutex> Lock(OutputMutex);
+                errs() << "Error: could not write output file '" << HFileName << "': " << toString(std::move(WriteError))
+                       << "\n";
+                Result = 1;
+            }
+        }
+        if (Cache && Result == 0) {
+            Cache->update(InputFile, HFileName, Info.Dependencies, Info.ContentHashes);
+        }
+        if (Options.WriteDepfile && Result == 0 && !writeDepfileOf({})) {
+            Result = 1;
+        }
+        if (Result != 0) {
+            Info.Status = "failed";
+        }
+        addStats();
+        return Result;
+    }
+
+    //each tool gets its own physical file system: it has its own working directory, so the tools running
+    //in parallel dont change the working directory of the process under each other
+    IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS(llvm::vfs::createPhysicalFileSystem().release());
+    //--stat-cache: the FileManager of the tool asks the shared stat cache before the file system
+    IntrusiveRefCntPtr<FileManager> Files;
+    if (StatCache) {
+        Files = new FileManager(FileSystemOptions(), FS);
+        Files->setStatCache(StatCache->createAdapter(Info));
+    }
+    clang::tooling::ClangTool Tool(Compilations, {InputFile}, std::make_shared<PCHContainerOperations>(), FS, Files);
+
+    //the diagnostics of the .c file are printed at once when the tool is done (the tools running in parallel
+    //dont interleave their lines) and kept in Info (--manifest)
+    std::string DiagnosticsText;
+    raw_string_ostream DiagnosticsStream(DiagnosticsText);
+    IntrusiveRefCntPtr<DiagnosticOptions> DiagOpts(new DiagnosticOptions());
+    TextDiagnosticPrinter DiagnosticPrinter(DiagnosticsStream, DiagOpts.get());
+    Tool.setDiagnosticConsumer(&DiagnosticPrinter);
+
+    // This line of code initiates the entire tool execution process.
+// It can be broken down into the following steps:
+//
+// 1. `std::make_unique<HeaderGeneratorFrontendActionFactory>(HFileName, Info, Options)`:
+//    - This creates a smart pointer (`std::unique_ptr`) to a new instance of
+//      `HeaderGeneratorFrontendActionFactory`, passing the desired output
+//      header filename (`HFileName`) to its constructor, the struct that
+//      receives the files included by the .c file and the timings (`Info`)
+//      and the parsing options (`Options`).
+//
+// 2. `.get()`:
+//    - This retrieves the raw pointer from the smart pointer. `Tool.run()`
+//      expects a raw pointer to a `FrontendActionFactory`.
+//
+// 3. `Tool.run(...)`:
+//    - The `ClangTool` object's `run()` method takes the factory and begins
+//      the compilation process. It handles the low-level details of setting up
+//      the compiler and parsing the source file (`InputFile`).
+//
+//    - During the run, the following callbacks and actions occur in order:
+//      a. **Factory creates Action**: `Tool.run()` calls the factory's `create()`
+//         method, which returns a `std::unique_ptr<HeaderGeneratorFrontendAction>`.
+//         This action object is responsible for the overall task.
+//
+//      b. **Action creates Consumer**: The `Tool.run()` method then calls the
+//         action's `CreateASTConsumer()` method. It provides a `CompilerInstance`
+//         object (`CI`), which contains the state of the compiler, including
+//         the preprocessor and the `ASTContext`.
+//
+//      c. **Preprocessor runs and collects includes**: Within the `HeaderGeneratorConsumer`'s
+//         constructor, an `IncludeCollector` is added to the preprocessor. CLANG
+//         runs the preprocessor, and the `IncludeCollector`'s `InclusionDirective`
+//         callback is executed for every `#include` directive, populating the
+//         `RequiredHeaders` set.
+//
+//      d. **AST is built**: After preprocessing, CLANG parses the code and builds
+//         the Abstract Syntax Tree (AST).
+//
+//      e. **Consumer processes AST**: `Tool.run()` calls the consumer's
+//         `HandleTranslationUnit()` method, passing the newly created `ASTContext`.
+//         This is where your custom logic takes over.
+//
+//         - `Visitor.TraverseDecl()`: The `HandleTranslationUnit` method
+//           initiates a traversal of the AST using the `FunctionDeclCollector`
+//           visitor.
+//
+//         - `VisitFunctionDecl()`: As the visitor encounters each function
+//           declaration in the AST, its `VisitFunctionDecl()` callback is
+//           executed. This callback extracts the function's details and adds
+//           its declaration string to the `FunctionDeclarations` set.
+//
+//      f. **Header is written**: After the traversal is complete, the
+//         `HandleTranslationUnit` method takes the collected `RequiredHeaders`
+//         and `FunctionDeclarations` and writes them, along with the header
+//         guard, to the specified output file (`HFileName`), unless the file
+//         already has this exact content.
+    //--verify: the .h file of the AST engine is compared with the one of the lexer engine before being written
+    std::string ASTContent;
+    HeaderSink VerifySink = [&](StringRef, StringRef Content) {
+        ASTContent = Content.str();
+        return Error::success();
+    };
+    bool Verify = UseLexer && Options.Verify;
+    int Result = Tool.run(
+        std::make_unique<HeaderGeneratorFrontendActionFactory>(HFileName, Info, Options, Verify ? &VerifySink : nullptr,
+                                                               Umbrella)
+            .get());
+    if (!DiagnosticsText.empty()) {
+        Info.Diagnostics = DiagnosticsText;
+        std::lock_guard<std::mutex> Lock(OutputMutex);
+        errs() << DiagnosticsText;
+    }
+
+    Info.Engine = "ast";
+    if (Verify && Result == 0) {
+        if (LexerContent && *LexerContent == ASTContent) {
+            Info.Engine = "lexer";
+        }
+        else
+        if (LexerContent) {
+            Info.LexerFallback = "the engines disagree";
+            printEngineDiff(InputFile, *LexerContent, ASTContent);
+        }
+        PhaseTimer Timer("Emit", HFileName, Info.EmitMs);
+        if (Error WriteError = emitHeader(HFileName, ASTContent, Info, Options)) {
+            std::lock_guard<std::mutex> Lock(OutputMutex);
+            errs() << "Error: could not write output file '" << HFileName << "': " << toString(std::move(WriteError))
+                   << "\n";
+            Result = 1;
+        }
+    }
+
+    if (Cache && Result == 0) {
+        Cache->update(InputFile, HFileName, Info.Dependencies, Info.ContentHashes);
+    }
+    if (Options.WriteDepfile && Result == 0) {
+        std::vector<std::string> Dependencies = Options.CommonDependencies;
+        Dependencies.insert(Dependencies.end(), Info.Dependencies.begin(), Info.Dependencies.end());
+        if (!writeDepfileOf(Dependencies)) {
+            Result = 1;
+        }
+    }
+    if (Result != 0) {
+        Info.Status = "failed";
+    }
+    addStats();
+    return Result;
+}
+
+// batch mode: runs generateHeader on each .c file on a pool of threads (one thread per core by default) ;
+// a failing .c file is reported at the end and doesnt stop the others
+// compilationsFor(i): the compilation database of SourceFiles[i]
+int generateHeaders(const std::vector<std::string> &SourceFiles,
+                    const std::function<const CompilationDatabase &(size_t)> &compilationsFor,
+                    const GeneratorOptions &Options, HeaderCache *Cache, StatsCollector *Stats, unsigned Jobs,
+                    UmbrellaStore *Umbrella, SharedStatCache *StatCache) {
+    std::vector<int> Results(SourceFiles.size(), 0);
+    llvm::DefaultThreadPool Pool(llvm::hardware_concurrency(Jobs));
+    for (size_t i = 0; i < SourceFiles.size(); ++i) {
+        Pool.async([&, i] {
+            //--time-trace: the profiler is per thread ; the spans of the task are handed to the main thread's
+            //profiler when it is finished (timeTraceProfilerWrite writes them all)
+            if (Options.TimeTrace) {
+                timeTraceProfilerInitialize(Options.TimeTraceGranularity, "generate_header_tool");
+            }
+            Results[i] = generateHeader(compilationsFor(i), SourceFiles[i], deriveOutputFileName(SourceFiles[i], Options), Options,
+                                        Cache, Stats, Umbrella, StatCache);
+            if (Options.TimeTrace) {
+                timeTraceProfilerFinishThread();
+            }
+        });
+    }
+    Pool.wait();
+
+    if (Cache) {
+        Cache->save();
+    }
+
+    std::vector<std::string> Failed;
+    for (size_t i = 0; i < SourceFiles.size(); ++i) {
+        if (Results[i] != 0) {
+            Failed.push_back(SourceFiles[i]);
+        }
+    }
+
+    outs() << SourceFiles.size() - Failed.size() << " of " << SourceFiles.size() << " headers generated.\n";
+    for (const std::string &File : Failed) {
+        errs() << "Error: failed to generate the header of " << File << "\n";
+    }
+    return Failed.empty() ? 0 : 1;
+}
+
+
+// parseAndTraverse : a ClangTool of its own, as generateHeader (the benchmark calls it from several threads)
+std::optional<size_t> parseAndTraverse(const CompilationDatabase &Compilations, const std::string &InputFile,
+                                       const GeneratorOptions &Options, TraversalMode Mode) {
+    IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS(llvm::vfs::createPhysicalFileSystem().release());
+    clang::tooling::ClangTool Tool(Compilations, {InputFile}, std::make_shared<PCHContainerOperations>(), FS);
+    size_t FunctionCount = 0;
+    TraversalFrontendActionFactory Factory(Mode, Options, FunctionCount);
+    if (Tool.run(&Factory) != 0) {
+        return std::nullopt;
+    }
+    return FunctionCount;
+}
+
+// UmbrellaStore::write : the functions of all the shards, sorted by declaration, with the merged includes.
+// the declarations of each function are sorted by .c file first: the one kept, and the conflicts reported, dont
+// depend on the order the threads added them
+int UmbrellaStore::write() {
+    std::vector<StringRef> Declarations;
+    std::set<std::string> Conflicts;
+    for (Shard &S : Shards) {
+        for (auto &Entry : S.Functions) {
+            std::vector<Function> &Variants = Entry.second;
+            llvm::sort(Variants, [](const Function &A, const Function &B) {
+                return std::tie(A.InputFile, A.Declaration) < std::tie(B.InputFile, B.Declaration);
+            });
+            const Function &First = Variants.front();
+            auto Other = llvm::find_if(Variants, [&](const Function &F) { return F.Signature != First.Signature; });
+            if (Other != Variants.end()) {
+                Conflicts.insert(formatv("conflicting declarations of {0}: '{1}' ({2}) and '{3}' ({4})", First.Key,
+                                         First.Declaration, First.InputFile, Other->Declaration, Other->InputFile)
+                                     .str());
+                continue;
+            }
+            Declarations.push_back(First.Declaration);
+        }
+    }
+    if (!Conflicts.empty()) {
+        for (const std::string &Conflict : Conflicts) {
+            errs() << "Error: " << Conflict << "\n";
+        }
+        errs() << "Error: " << Conflicts.size() << " conflicting declarations, " << UmbrellaFilePath << " not written.\n";
+        return 1;
+    }
+    llvm::sort(Declarations);
+    Declarations.erase(std::unique(Declarations.begin(), Declarations.end()), Declarations.end());
+
+    TranslationUnitInfo Info;
+    std::string Content = renderHeader(UmbrellaFilePath, Headers, ForwardDeclarations, Declarations, false, false);
+    if (Error WriteError = emitHeader(UmbrellaFilePath, Content, Info, GeneratorOptions())) {
+        errs() << "Error: could not write output file '" << UmbrellaFilePath << "': " << toString(std::move(WriteError))
+               << "\n";
+        return 1;
+    }
+    outs() << Declarations.size() << " declarations in " << UmbrellaFilePath << ".\n";
+    return 0;
+}
+
+// StatsCollector::write : one object per .c file, then the totals of the run
+bool StatsCollector::write(StringRef FileName) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    std::sort(Infos.begin(), Infos.end(),
+              [](const TranslationUnitInfo &A, const TranslationUnitInfo &B) { return A.InputFile < B.InputFile; });
+
+    TranslationUnitInfo Totals;
+    std::map<std::string, size_t> StatusCounts;
+    std::map<std::string, size_t> EngineCounts;
+    size_t LexerFallbacks = 0;
+    for (const TranslationUnitInfo &Info : Infos) {
+        Totals.DeclsVisited += Info.DeclsVisited;
+        Totals.DeclsKept += Info.DeclsKept;
+        Totals.IncludesCollected += Info.IncludesCollected;
+        Totals.IncludesDropped += Info.IncludesDropped;
+        Totals.StatCalls += Info.StatCalls;
+        Totals.StatCallsSaved += Info.StatCallsSaved;
+        Totals.LexMs += Info.LexMs;
+        Totals.SetupMs += Info.SetupMs;
+        Totals.ParseMs += Info.ParseMs;
+        Totals.IncludeCallbacksMs += Info.IncludeCallbacksMs;
+        Totals.TraverseMs += Info.TraverseMs;
+        Totals.FormatMs += Info.FormatMs;
+        Totals.EmitMs += Info.EmitMs;
+        Totals.TotalMs += Info.TotalMs;
+        StatusCounts[Info.Status]++;
+        if (!Info.Engine.empty()) {
+            EngineCounts[Info.Engine]++;
+        }
+        LexerFallbacks += !Info.LexerFallback.empty();
+    }
+
+    //the fields shared by the files and the totals
+    auto writeCounters = [](llvm::json::OStream &J, const TranslationUnitInfo &Info) {
+        J.attribute("decls_visited", static_cast<int64_t>(Info.DeclsVisited));
+        J.attribute("decls_kept", static_cast<int64_t>(Info.DeclsKept));
+        J.attribute("includes", static_cast<int64_t>(Info.IncludesCollected));
+        J.attribute("includes_dropped", static_cast<int64_t>(Info.IncludesDropped));
+        J.attribute("stat_calls", static_cast<int64_t>(Info.StatCalls));
+        J.attribute("stat_calls_saved", static_cast<int64_t>(Info.StatCallsSaved));
+        J.attribute("lex_ms", Info.LexMs);
+        J.attribute("setup_ms", Info.SetupMs);
+        J.attribute("parse_ms", Info.ParseMs);
+        J.attribute("include_callbacks_ms", Info.IncludeCallbacksMs);
+        J.attribute("traverse_ms", Info.TraverseMs);
+        J.attribute("format_ms", Info.FormatMs);
+        J.attribute("emit_ms", Info.EmitMs);
+        J.attribute("total_ms", Info.TotalMs);
+    };
+
+    Error WriteError = writeToOutput(FileName, [&](raw_ostream &OS) {
+        llvm::json::OStream J(OS, 2);
+        J.object([&] {
+            J.attributeArray("files", [&] {
+                for (const TranslationUnitInfo &Info : Infos) {
+                    J.object([&] {
+                        J.attribute("input", Info.InputFile);
+                        J.attribute("output", Info.OutputFile);
+                        J.attribute("status", Info.Status);
+                        if (!Info.Engine.empty()) {
+                            J.attribute("engine", Info.Engine);
+                        }
+                        if (!Info.LexerFallback.empty()) {
+                            J.attribute("lexer_fallback", Info.LexerFallback);
+                        }
+                        writeCounters(J, Info);
+                    });
+                }
+            });
+            J.attributeObject("totals", [&] {
+                J.attribute("files", static_cast<int64_t>(Infos.size()));
+                for (const auto &[Status, Count] : StatusCounts) {
+                    J.attribute(Status, static_cast<int64_t>(Count));
+                }
+                J.attributeObject("engines", [&] {
+                    for (const auto &[Engine, Count] : EngineCounts) {
+                        J.attribute(Engine, static_cast<int64_t>(Count));
+                    }
+                });
+                J.attribute("lexer_fallbacks", static_cast<int64_t>(LexerFallbacks));
+                writeCounters(J, Totals);
+            });
+        });
+        OS << "\n";
+        return Error::success();
+    });
+    if (WriteError) {
+        errs() << "Error: Could not write the stats file " << FileName << ": " << toString(std::move(WriteError)) << "\n";
+        return false;
+    }
+    return true;
+}
+
+// StatsCollector::printSummary : the totals of the run on one line per phase
+void StatsCollector::printSummary(raw_ostream &OS) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    double Setup = 0, Parse = 0, Includes = 0, Traverse = 0, Emit = 0;
+    size_t Visited = 0, Kept = 0, Lexed = 0, Fallbacks = 0;
+    for (const TranslationUnitInfo &Info : Infos) {
+        Lexed += Info.Engine == "lexer";
+        Fallbacks += !Info.LexerFallback.empty();
+        Setup += Info.SetupMs;
+        Parse += Info.ParseMs;
+        Includes += Info.IncludeCallbacksMs;
+        Traverse += Info.TraverseMs;
+        Emit += Info.EmitMs;
+        Visited += Info.DeclsVisited;
+        Kept += Info.DeclsKept;
+    }
+    OS << formatv("{0} files: setup {1:f1} ms, parse {2:f1} ms (include callbacks {3:f1} ms), traverse {4:f1} ms, "
+                  "emit {5:f1} ms ; {6} function declarations kept of {7} top level declarations\n",
+                  Infos.size(), Setup, Parse, Includes, Traverse, Emit, Kept, Visited);
+    if (Lexed + Fallbacks > 0) {
+        OS << formatv("{0} files generated by the lexer engine, {1} by the AST engine after a lexer fallback\n", Lexed,
+                      Fallbacks);
+    }
+}
+
+// in-memory API: the same action as generateHeader, run by a ToolInvocation on an in-memory file system
+bool generateHeaderInMemory(StringRef Source, StringRef FileName, StringRef HFileName, const std::vector<std::string> &Flags,
+                            const GeneratorOptions &Options, const HeaderSink &Sink,
+                            const std::map<std::string, std::string> &VirtualFiles, std::string *Diagnostics,
+                            TranslationUnitInfo *Info) {
+    //the in-memory files are laid over a physical file system of their own (own working directory: thread safe)
+    IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> OverlayFS(
+        new llvm::vfs::OverlayFileSystem(llvm::vfs::createPhysicalFileSystem().release()));
+    IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> MemoryFS(new llvm::vfs::InMemoryFileSystem);
+    OverlayFS->pushOverlay(MemoryFS);
+    MemoryFS->addFile(FileName, 0, MemoryBuffer::getMemBufferCopy(Source, FileName));
+    for (const auto &[Path, Content] : VirtualFiles) {
+        MemoryFS->addFile(Path, 0, MemoryBuffer::getMemBufferCopy(Content, Path));
+    }
+    IntrusiveRefCntPtr<FileManager> Files(new FileManager(FileSystemOptions(), OverlayFS));
+
+    //the command line of a syntax only run (same as runToolOnCodeWithArgs)
+    std::vector<std::string> CommandLine = {"generate_header_tool", "-fsyntax-only"};
+    CommandLine.insert(CommandLine.end(), Flags.begin(), Flags.end());
+    CommandLine.push_back(FileName.str());
+
+    TranslationUnitInfo LocalInfo;
+    TranslationUnitInfo &UnitInfo = Info ? *Info : LocalInfo;
+    UnitInfo.InputFile = FileName.str();
+    UnitInfo.OutputFile = HFileName.str();
+
+    ToolInvocation Invocation(CommandLine,
+                              std::make_unique<HeaderGeneratorFrontendAction>(HFileName, UnitInfo, Options, &Sink),
+                              Files.get(), std::make_shared<PCHContainerOperations>());
+
+    //the diagnostics are returned to the caller instead of being printed
+    std::string DiagnosticsText;
+    raw_string_ostream DiagnosticsStream(DiagnosticsText);
+    IntrusiveRefCntPtr<DiagnosticOptions> DiagOpts(new DiagnosticOptions());
+    TextDiagnosticPrinter DiagnosticPrinter(DiagnosticsStream, DiagOpts.get());
+    if (Diagnostics) {
+        Invocation.setDiagnosticConsumer(&DiagnosticPrinter);
+    }
+
+    bool Success = Invocation.run();
+    if (Diagnostics) {
+        *Diagnostics = std::move(DiagnosticsStream.str());
+    }
+    if (!Success) {
+        UnitInfo.Status = "failed";
+    }
+    return Success;
+}
+
+InMemoryHeader generateHeaderInMemory(StringRef Source, StringRef FileName, StringRef HFileName,
+                                      const std::vector<std::string> &Flags, const GeneratorOptions &Options,
+                                      const std::map<std::string, std::string> &VirtualFiles) {
+    InMemoryHeader Result;
+    HeaderSink Sink = [&](StringRef, StringRef Content) {
+        Result.Content = Content.str();
+        return Error::success();
+    };
+    Result.Success = generateHeaderInMemory(Source, FileName, HFileName, Flags, Options, Sink, VirtualFiles,
+                                            &Result.Diagnostics, &Result.Info);
+    return Result;
+}
+
+// StatsCollector::writeManifest : the shard, then one object per .c file
+bool StatsCollector::writeManifest(StringRef FileName, unsigned Shard, unsigned Shards) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    std::sort(Infos.begin(), Infos.end(),
+              [](const TranslationUnitInfo &A, const TranslationUnitInfo &B) { return A.InputFile < B.InputFile; });
+
+    Error WriteError = writeToOutput(FileName, [&](raw_ostream &OS) {
+        llvm::json::OStream J(OS, 2);
+        J.object([&] {
+            J.attribute("shard", static_cast<int64_t>(Shard));
+            J.attribute("shards", static_cast<int64_t>(Shards));
+            J.attributeArray("files", [&] {
+                for (const TranslationUnitInfo &Info : Infos) {
+                    J.object([&] {
+                        J.attribute("input", Info.InputFile);
+                        J.attribute("output", Info.OutputFile);
+                        J.attribute("status", Info.Status);
+                        //the hash of the .h file as written (generated, unchanged or cached): the merge step checks it
+                        std::optional<uint64_t> Hash;
+                        if (Info.Status != "failed") {
+                            Hash = hashFileContent(Info.OutputFile);
+                        }
+                        if (Hash) {
+                            J.attribute("output_hash", utohexstr(*Hash));
+                        }
+                        else {
+                            J.attribute("output_hash", nullptr);
+                        }
+                        J.attribute("total_ms", Info.TotalMs);
+                        if (!Info.Diagnostics.empty()) {
+                            J.attribute("diagnostics", Info.Diagnostics);
+                        }
+                    });
+                }
+            });
+        });
+        OS << "\n";
+        return Error::success();
+    });
+    if (WriteError) {
+        errs() << "Error: Could not write the manifest " << FileName << ": " << toString(std::move(WriteError)) << "\n";
+        return false;
+    }
+    return true;
+}
+
+// reads a manifest file (of a shard or merged) ; returns nothing (and prints why) if it cant be read or parsed
+static std::optional<json::Value> readManifest(StringRef FileName) {
+    auto Buffer = MemoryBuffer::getFile(FileName);
+    if (!Buffer) {
+        errs() << "Error: Could not read the manifest " << FileName << "\n";
+        return std::nullopt;
+    }
+    Expected<json::Value> Manifest = json::parse((*Buffer)->getBuffer());
+    if (!Manifest) {
+        errs() << "Error: Invalid manifest " << FileName << ": " << toString(Manifest.takeError()) << "\n";
+        return std::nullopt;
+    }
+    if (!Manifest->getAsObject() || !Manifest->getAsObject()->getArray("files")) {
+        errs() << "Error: Invalid manifest " << FileName << ": no \"files\" array\n";
+        return std::nullopt;
+    }
+    return std::move(*Manifest);
+}
+
+// sharded mode: hash partition, or balanced partition on the durations of a previous run
+std::optional<std::vector<std::string>> selectShard(std::vector<std::string> SourceFiles, unsigned Shard, unsigned Shards,
+                                                    StringRef TimingsFile) {
+    //the same order on every node: the directories arent walked in the same order everywhere
+    llvm::sort(SourceFiles);
+    SourceFiles.erase(std::unique(SourceFiles.begin(), SourceFiles.end()), SourceFiles.end());
+
+    std::vector<std::string> Selected;
+    if (TimingsFile.empty()) {
+        for (const std::string &File : SourceFiles) {
+            if (xxh3_64bits(arrayRefFromStringRef(File)) % Shards == Shard) {
+                Selected.push_back(File);
+            }
+        }
+        return Selected;
+    }
+
+    std::optional<json::Value> Timings = readManifest(TimingsFile);
+    if (!Timings) {
+        return std::nullopt;
+    }
+    //a cached .c file took no time in the previous run, but it can be parsed in this one (its cache entry is on
+    //another node, or it changed): it is weighted as a new .c file
+    std::map<std::string, double> PreviousMs;
+    for (const json::Value &File : *Timings->getAsObject()->getArray("files")) {
+        const json::Object *Object = File.getAsObject();
+        std::optional<StringRef> Input = Object ? Object->getString("input") : std::nullopt;
+        std::optional<double> TotalMs = Object ? Object->getNumber("total_ms") : std::nullopt;
+        if (Input && TotalMs && Object->getString("status").value_or("") != "cached") {
+            PreviousMs[Input->str()] = *TotalMs;
+        }
+    }
+
+    //weight of a .c file: its previous duration ; a new .c file: its size times the average ms per byte of the known ones
+    std::vector<std::pair<double, const std::string *>> Weights;
+    double KnownMs = 0, KnownBytes = 0;
+    std::vector<uint64_t> Sizes(SourceFiles.size(), 0);
+    for (size_t i = 0; i < SourceFiles.size(); ++i) {
+        llvm::sys::fs::file_size(SourceFiles[i], Sizes[i]);
+        auto Previous = PreviousMs.find(SourceFiles[i]);
+        if (Previous != PreviousMs.end()) {
+            KnownMs += Previous->second;
+            KnownBytes += Sizes[i];
+        }
+    }
+    double MsPerByte = KnownBytes > 0 ? KnownMs / KnownBytes : 1;
+    for (size_t i = 0; i < SourceFiles.size(); ++i) {
+        auto Previous = PreviousMs.find(SourceFiles[i]);
+        Weights.push_back({Previous != PreviousMs.end() ? Previous->second : Sizes[i] * MsPerByte, &SourceFiles[i]});
+    }
+
+    //longest processing time first: each .c file goes to the least loaded shard (the lowest one on a tie)
+    std::sort(Weights.begin(), Weights.end(), [](const auto &A, const auto &B) {
+        return A.first != B.first ? A.first > B.first : *A.second < *B.second;
+    });
+    std::vector<double> Loads(Shards, 0);
+    for (const auto &[Weight, File] : Weights) {
+        unsigned Target = std::min_element(Loads.begin(), Loads.end()) - Loads.begin();
+        Loads[Target] += Weight;
+        if (Target == Shard) {
+            Selected.push_back(*File);
+        }
+    }
+    llvm::sort(Selected);
+    return Selected;
+}
+
+// --merge-manifests: validates the manifests of the shards and writes them as one manifest
+int mergeManifests(StringRef OutputFile, const std::vector<std::string> &ManifestFiles) {
+    std::vector<std::string> Errors;
+    std::optional<int64_t> Shards;
+    std::map<int64_t, std::string> SeenShards; //shard -> manifest
+    std::map<std::string, std::string> SeenInputs; //.c file -> manifest
+    json::Array Files;
+    double TotalMs = 0;
+    size_t Failed = 0;
+
+    for (const std::string &ManifestFile : ManifestFiles) {
+        std::optional<json::Value> Manifest = readManifest(ManifestFile);
+        if (!Manifest) {
+            return 1;
+        }
+        json::Object &Object = *Manifest->getAsObject();
+        std::optional<int64_t> Shard = Object.getInteger("shard");
+        std::optional<int64_t> ManifestShards = Object.getInteger("shards");
+        if (!Shard || !ManifestShards || *Shard < 0 || *Shard >= *ManifestShards) {
+            Errors.push_back(ManifestFile + ": invalid \"shard\" or \"shards\"");
+            continue;
+        }
+        if (Shards && *Shards != *ManifestShards) {
+            Errors.push_back(ManifestFile + ": " + std::to_string(*ManifestShards) + " shards, the other manifests have " +
+                             std::to_string(*Shards));
+            continue;
+        }
+        Shards = ManifestShards;
+        if (!SeenShards.emplace(*Shard, ManifestFile).second) {
+            Errors.push_back(ManifestFile + ": shard " + std::to_string(*Shard) + " already in " + SeenShards[*Shard]);
+            continue;
+        }
+
+        for (json::Value &File : *Object.getArray("files")) {
+            json::Object *FileObject = File.getAsObject();
+            std::optional<StringRef> Input = FileObject ? FileObject->getString("input") : std::nullopt;
+            if (!Input) {
+                Errors.push_back(ManifestFile + ": a file has no \"input\"");
+                continue;
+            }
+            if (!SeenInputs.emplace(Input->str(), ManifestFile).second) {
+                Errors.push_back(Input->str() + " is in " + ManifestFile + " and in " + SeenInputs[Input->str()]);
+                continue;
+            }
+            if (FileObject->getString("status").value_or("") == "failed") {
+                Failed++;
+                Errors.push_back(Input->str() + " failed in " + ManifestFile);
+            }
+
+            //the .h files of this node: they must not have changed since their shard wrote them
+            std::optional<StringRef> Output = FileObject->getString("output");
+            std::optional<StringRef> OutputHash = FileObject->getString("output_hash");
+            if (Output && OutputHash && llvm::sys::fs::exists(*Output)) {
+                std::optional<uint64_t> Hash = hashFileContent(*Output);
+                if (!Hash || utohexstr(*Hash) != *OutputHash) {
+                    Errors.push_back(Output->str() + " doesnt match the hash of " + ManifestFile);
+                }
+            }
+
+            TotalMs += FileObject->getNumber("total_ms").value_or(0);
+            Files.push_back(std::move(File));
+        }
+    }
+
+    if (Shards) {
+        for (int64_t Shard = 0; Shard < *Shards; ++Shard) {
+            if (!SeenShards.count(Shard)) {
+                Errors.push_back("the manifest of shard " + std::to_string(Shard) + " is missing");
+            }
+        }
+    }
+    else {
+        Errors.push_back("no valid manifest");
+    }
+
+    //the merged manifest is only written if the manifests are valid: a run with a missing, duplicated or failed
+    //shard must not look complete
+    if (!Errors.empty()) {
+        for (const std::string &Message : Errors) {
+            errs() << "Error: " << Message << "\n";
+        }
+        errs() << "Error: " << Errors.size() << " errors in the manifests, " << OutputFile << " not written.\n";
+        return 1;
+    }
+
+    std::sort(Files.begin(), Files.end(), [](const json::Value &A, const json::Value &B) {
+        return A.getAsObject()->getString("input").value_or("") < B.getAsObject()->getString("input").value_or("");
+    });
+    size_t NumFiles = Files.size();
+    json::Object Merged{
+        {"shards", Shards.value_or(0)},
+        {"files", std::move(Files)},
+        {"totals", json::Object{{"files", static_cast<int64_t>(NumFiles)},
+                                {"failed", static_cast<int64_t>(Failed)},
+                                {"total_ms", TotalMs}}},
+    };
+    Error WriteError = writeToOutput(OutputFile, [&](raw_ostream &OS) {
+        OS << formatv("{0:2}", json::Value(std::move(Merged))) << "\n";
+        return Error::success();
+    });
+    if (WriteError) {
+        errs() << "Error: Could not write the manifest " << OutputFile << ": " << toString(std::move(WriteError)) << "\n";
+        return 1;
+    }
+
+    outs() << "Merged " << SeenShards.size() << " manifests (" << NumFiles << " files) into " << OutputFile << ".\n";
+    return 0;
+}
+
+} // namespace headergen
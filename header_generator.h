@@ -0,0 +1,496 @@
+#ifndef HEADER_GENERATOR_H_
+#define HEADER_GENERATOR_H_
+
+// the API of the library headergen, shared by generate_header_tool and the benchmark (generate_header_bench): the
+// options and the results of the generation of a .h file, the caches of a run, the batch, sharded and in-memory
+// (generateHeaderInMemory) generation. declarations only: the classes that collect the includes and the functions
+// declarations of a .c file (clang AST visitor, lexer engine, frontend actions) are in header_generator.cpp
+
+#include "clang/Tooling/CompilationDatabase.h" //CompilationDatabase: the compilation flags of the .c files
+#include "llvm/ADT/StringMap.h" //used by --umbrella and --stat-cache
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/VirtualFileSystem.h" //vfs::Status: used by --stat-cache
+#include "llvm/Support/raw_ostream.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace clang {
+class FileSystemStatCache;
+}
+
+namespace headergen {
+
+// hash of a file content ; returns nothing if the file cant be read
+std::optional<uint64_t> hashFileContent(llvm::StringRef Path);
+
+// the name of the module written in a .cppm file (--emit-module): its file name without extension, made of
+// identifier characters: src/my-file.cppm -> my_file
+std::string deriveModuleName(llvm::StringRef OutputFile);
+
+// true for the C++ source files (.cpp, .cc, .cxx): they are parsed as C++20
+bool isCXXSourceFile(llvm::StringRef File);
+
+// ExtractionEngine : how the declarations of a .c file are found (--engine)
+enum class ExtractionEngine {
+    AST,  //clang parses the .c file and its included files (FunctionDeclCollector)
+    Lexer //a raw lexer reads the .c file alone (LexerDeclExtractor) ; the AST engine if it cant
+};
+
+// GeneratorOptions : the options of the typed command that change how the .c files are parsed
+struct GeneratorOptions {
+    //--skip-bodies: the parser skips the functions bodies (only the signatures are needed to generate the .h file)
+    bool SkipFunctionBodies = false;
+    //--time-trace: each thread records its spans for the Chrome trace
+    bool TimeTrace = false;
+    unsigned TimeTraceGranularity = 0; //us: shorter spans arent recorded (--time-trace-granularity)
+    //--minimal-includes: only the #include lines needed by the declarations are written in the .h file
+    bool MinimalIncludes = false;
+    //-MD: a depfile (Make/Ninja format) is written with each .h file: <.h file>.d, or DepfileName (-MF, single .c file)
+    bool WriteDepfile = false;
+    std::string DepfileName;
+    std::vector<std::string> CommonDependencies; //dependencies of all the .c files (ex: the headers of a PCH)
+    //--emit-module: a C++20 module interface unit (.cppm) is written instead of the .h file
+    bool EmitModule = false;
+    //--engine=lexer|ast
+    ExtractionEngine Engine = ExtractionEngine::AST;
+    //--verify: both engines run, the .h file of the AST engine is written ; the .c files where they disagree are reported
+    bool Verify = false;
+};
+
+// HeaderSink : receives the content of a generated .h file instead of the disk (in-memory API: generateHeaderInMemory) ;
+// a returned error fails the generation
+using HeaderSink = std::function<llvm::Error(llvm::StringRef OutputFile, llvm::StringRef Content)>;
+
+// TranslationUnitInfo : what the tool learns about one .c file while generating its .h file
+struct TranslationUnitInfo {
+    std::string InputFile;
+    std::string OutputFile;
+    std::string Status; //generated, unchanged, cached or failed
+    std::set<std::string> Dependencies; //the files included by the .c file (directly or not)
+    std::string Diagnostics; //the compiler errors and warnings, as printed by clang
+    std::string Engine; //the engine whose .h file was written: ast or lexer
+    std::string LexerFallback; //why the lexer engine wasnt used (unsupported construct, or the engines disagree: --verify)
+    //--cache: the hashes of the content the parser read (the .c file and the included files) ; the key of the .h file
+    //is computed from them, so an edit made during the parse leaves the .h file out of date
+    bool HashContents = false;
+    std::map<std::string, uint64_t> ContentHashes;
+
+    //counters (--stats)
+    //top level declarations given by the parser, before any filtering: the ones of the included files too (not the
+    //ones read from a PCH) ; lexer engine: the top level declarations of the .c file
+    size_t DeclsVisited = 0;
+    size_t DeclsKept = 0; //function declarations written in the .h file
+    size_t IncludesCollected = 0; //#include lines of the .c file
+    size_t IncludesDropped = 0; //#include lines of the .c file not written in the .h file (--minimal-includes)
+    size_t StatCalls = 0; //file system lookups of the FileManager (--stat-cache)
+    size_t StatCallsSaved = 0; //lookups answered by the stat cache, without a syscall
+
+    //durations in ms (--stats)
+    double LexMs = 0; //lexer engine: reading and lexing the .c file, formatting the declarations
+    double SetupMs = 0; //compiler instance setup before the parse: the AST consumer, the PCH loading (-include-pch)
+    double ParseMs = 0; //preprocessing + AST construction (clang preprocesses while it parses: one phase)
+    double IncludeCallbacksMs = 0; //time spent in IncludeCollector (part of ParseMs)
+    double TraverseMs = 0; //FunctionDeclCollector traversal
+    double FormatMs = 0; //declarations formatting (part of TraverseMs)
+    double EmitMs = 0; //.h file generation + comparison + writing
+    double TotalMs = 0;
+};
+
+/*-----------------------------------------------------------------------------------------------*/
+/* classes (header_generator.cpp)                                                              */
+/*-----------------------------------------------------------------------------------------------*/
+
+// UmbrellaStore : the declarations of all the .c files of a run, merged into one umbrella header (--umbrella).
+// the generators running in parallel add their functions at the same time: the store is split in shards, each
+// with its own mutex and hash table (function -> its declarations) ; a function goes to the shard of the hash of its key.
+// every declaration of a function is kept until write(): it sorts them, so that the umbrella header and the conflicts
+// dont depend on the order the threads added them. a function declared by several .c files with the same type is
+// written once ; with two different types, it is a conflict: an error, and the umbrella header isnt written
+// members: UmbrellaDir, CurrentDir, UmbrellaFilePath, Shards, Mutex (for: Headers, ForwardDeclarations)
+class UmbrellaStore {
+public:
+    // Function : a function with external linkage of a .c file
+    struct Function {
+        std::string Key; //its name ; name(parameter types) in C++: the overloads of a function are other functions
+        std::string Signature; //its type: "int (int, char *)"
+        std::string Declaration; //as written in a .h file
+        std::string InputFile;
+    };
+
+private:
+    struct Shard {
+        std::mutex Mutex;
+        llvm::StringMap<std::vector<Function>> Functions; //key: Function::Key
+    };
+    static constexpr size_t ShardCount = 64;
+
+    std::string UmbrellaFilePath;
+    std::string UmbrellaDir; //absolute
+    std::string CurrentDir;
+    Shard Shards[ShardCount];
+    std::mutex Mutex;
+    std::set<std::string> Headers;
+    std::set<std::string> ForwardDeclarations;
+
+    //Path relative to Dir if Path is in Dir (compared component by component: "src_gen/a.h" isnt in "src")
+    static std::optional<std::string> relativePath(llvm::StringRef Path, llvm::StringRef Dir);
+
+    //a "..." include is found from the directory of its .c file (or from a -I directory): it is rebased from the path
+    //of the file it resolved to (IncludePaths). it is made relative to the directory of the umbrella header if the
+    //file is in it, else relative to the working directory if the file is in it, else absolute
+    std::string rebaseInclude(llvm::StringRef Header, const std::map<std::string, std::string> &IncludePaths) const;
+
+public:
+    //ctor
+    explicit UmbrellaStore(llvm::StringRef UmbrellaFile);
+
+    // adds the functions and the includes of a .c file ; IncludePaths: the path of the file of each of its includes
+    void add(const std::set<std::string> &FileHeaders, const std::map<std::string, std::string> &IncludePaths,
+             const std::set<std::string> &FileForwardDeclarations, std::vector<Function> Functions);
+
+    // writes the umbrella header (sorted declarations, merged includes), unless there are conflicts: they are printed
+    // as errors. returns 0 on success
+    int write();
+};
+
+
+// HeaderCache : a persistent (on disk) cache of the .c files whose .h file is up to date.
+// each .c file has an entry with: its .h file, the files it includes (directly or not) and a key ;
+// the key is a hash of: the .c file + the included files + the compilation flags.
+// a .c file whose key didnt change since the last run doesnt need to be parsed again.
+// the cache is shared by the tools running in parallel (batch mode): its methods are thread safe ; the mutex only
+// guards the maps, the files are hashed without it
+// members: CacheFilePath, FlagsHash, CommonDependencies, Entries, FileHashes
+class HeaderCache {
+private:
+    struct Entry {
+        std::string OutputFile;
+        uint64_t Key = 0;
+        std::vector<std::string> Dependencies;
+    };
+    //hash of a file, computed once: the first thread that needs it hashes the file, the others wait for it
+    struct FileHash {
+        std::once_flag Once;
+        std::optional<uint64_t> Hash;
+    };
+
+    std::string CacheFilePath;
+    uint64_t FlagsHash;
+    std::vector<std::string> CommonDependencies; //dependencies of all the .c files (ex: the headers of a PCH)
+    std::map<std::string, Entry> Entries; //key: .c file
+    std::map<std::string, std::shared_ptr<FileHash>> FileHashes; //hashes of the files read during this run
+    std::mutex Mutex;
+
+    //hash of a file content ; computed once per run for each file (most of the included files are
+    //shared by all the .c files)
+    std::optional<uint64_t> hashFile(const std::string &Path);
+
+    //key of a .c file: hash of the hashes of the .c file and of its dependencies, and of the flags ; a file in
+    //ContentHashes (what the parser read) isnt hashed again. returns nothing if one of the files cant be read
+    std::optional<uint64_t> computeKey(const std::string &InputFile, const std::vector<std::string> &CommonDependencies,
+                                       const std::vector<std::string> &Dependencies,
+                                       const std::map<std::string, uint64_t> &ContentHashes);
+
+public:
+    //ctor
+    HeaderCache(llvm::StringRef CacheFile, const std::vector<std::string> &Flags);
+
+    // reads the cache file ; the cache file has the format:
+    //      generate_header_cache <flags hash>
+    //      <.c file>\t<.h file>\t<key>\t<number of dependencies>
+    //      <dependency>            (one line per dependency)
+    //      ...
+    // a missing cache file, or a cache file written with other flags, gives an empty cache
+    void load();
+
+    //writes the cache file (atomically)
+    void save();
+
+    //adds files that all the .c files depend on, without the preprocessor seeing them (the headers
+    //read from a PCH aren't reported to the IncludeCollector)
+    void setCommonDependencies(const std::vector<std::string> &Dependencies);
+
+    //watch mode: a file was written, the next regeneration starts a new run: the hashes of the files are computed again
+    void invalidate();
+
+    //true if the .h file of InputFile exists and nothing changed since it was generated
+    bool isUpToDate(const std::string &InputFile, const std::string &OutputFile);
+
+    //the dependencies of InputFile recorded by the last run (the common ones first) ; used to write the depfile
+    //of a .c file that isnt parsed again
+    std::vector<std::string> getDependencies(const std::string &InputFile);
+
+    //records that the .h file of InputFile was generated from InputFile and Dependencies ; ContentHashes: the hashes
+    //of the content the parser read (TranslationUnitInfo::ContentHashes), the files missing from it are hashed now
+    void update(const std::string &InputFile, const std::string &OutputFile, const std::set<std::string> &Dependencies,
+                const std::map<std::string, uint64_t> &ContentHashes);
+};
+
+
+// SharedStatCache : the results of the file system lookups (stat, open) of the FileManagers of all the .c files of a
+// run (--stat-cache). most of them are the header search: each #include is looked for in each -I directory, so each
+// .c file repeats the same failed lookups for the same headers.
+//      - a file or a directory found is kept for the run only (an old stat of a file that changed would give its old
+//        size) ; a file to open is always opened (the FileManager needs it), only its stat is shared
+//      - a missing file is kept between runs, in the cache file: it is still missing if its directory didnt change
+//        (same mtime, inode and device: creating or renaming a file in a directory changes its mtime). each directory
+//        is checked once per run (or once per regeneration in watch mode: invalidate())
+// its methods are thread safe
+// members: CacheFilePath, Found, Missing, CheckedDirectories, Mutex, Lookups, Saved, DirectoryChecks
+class SharedStatCache {
+private:
+    // DirectoryState : what a directory was when a file of it was missing ; the file is still missing while the
+    // directory is the same
+    struct DirectoryState {
+        bool Exists = false;
+        uint64_t MTime = 0; //ns
+        uint64_t Device = 0;
+        uint64_t Inode = 0;
+
+        bool operator==(const DirectoryState &Other) const {
+            return Exists == Other.Exists && MTime == Other.MTime && Device == Other.Device && Inode == Other.Inode;
+        }
+    };
+
+    // Adapter : the stat cache of one FileManager (FileManager::setStatCache takes its ownership) ; it counts the
+    // lookups of its .c file in Info
+    class Adapter;
+
+    std::string CacheFilePath;
+    llvm::StringMap<llvm::vfs::Status> Found; //this run
+    llvm::StringMap<DirectoryState> Missing; //missing file -> its directory when it was missing
+    llvm::StringMap<DirectoryState> CheckedDirectories; //this run
+    std::mutex Mutex;
+    std::atomic<size_t> Lookups{0};
+    std::atomic<size_t> Saved{0}; //lookups answered without a syscall
+    std::atomic<size_t> DirectoryChecks{0}; //the syscalls done to validate the missing files
+
+    //the state of a directory, checked once per run (the stat is done without the lock)
+    DirectoryState checkDirectory(llvm::StringRef Dir, llvm::vfs::FileSystem &FS);
+
+    //FileSystemStatCache::getStat of all the FileManagers: the lookup is done by the cache, or by FS (and recorded).
+    //a file to open (F) is opened, as FileSystemStatCache::get does without a cache
+    std::error_code getStat(llvm::StringRef Path, llvm::vfs::Status &Status, bool isFile,
+                            std::unique_ptr<llvm::vfs::File> *F, llvm::vfs::FileSystem &FS, TranslationUnitInfo &Info);
+
+public:
+    //ctor
+    explicit SharedStatCache(llvm::StringRef CacheFile);
+
+    // the stat cache of a FileManager: FileManager::setStatCache(Cache.createAdapter(Info))
+    std::unique_ptr<clang::FileSystemStatCache> createAdapter(TranslationUnitInfo &Info);
+
+    // reads the cache file ; the cache file has the format:
+    //      generate_header_stat_cache 1
+    //      <missing file>\t<its directory exists: 0 or 1>\t<directory mtime>\t<directory device>\t<directory inode>
+    //      ...
+    // a missing or corrupted cache file gives an empty cache
+    void load();
+
+    // writes the missing files (atomically) ; the found ones are only valid for this run
+    void save();
+
+    // watch mode: a file was written, the next regeneration starts a new run: the found files are looked up again and
+    // the directories checked again (the missing files of a directory that changed are looked up again)
+    void invalidate();
+
+    // prints the lookups, the ones answered by the cache, and the syscalls saved (the directory checks are syscalls)
+    void printSummary(llvm::raw_ostream &OS) const;
+};
+
+
+// PrecompiledPrefix : a PCH of the system headers (#include <...>) that the .c files include first.
+// the PCH is stored in a cache directory and reused by all the .c files of a run and by the next runs:
+//      <cache dir>/prefix-<key>.h      the prefix header: the #include lines
+//      <cache dir>/prefix-<key>.pch    the PCH of the prefix header
+//      <cache dir>/prefix-<key>.deps   the files the PCH was built from, with the hash of their content, their size
+//                                      and mtime: a file is hashed again only if its size or mtime changed
+// the key is a hash of the prefix header and of the compilation flags ; the PCH is rebuilt when
+// one of the files it was built from changed.
+// a .c file uses the PCH only if its first headers are the headers of the PCH, in the same order: so it sees
+// exactly the same declarations and macros as without the PCH
+// members: Headers, PrefixFilePath, PCHFilePath, DepsFilePath, Dependencies
+class PrecompiledPrefix {
+private:
+    std::vector<std::string> Headers;
+    std::string PrefixFilePath;
+    std::string PCHFilePath;
+    std::string DepsFilePath;
+    std::vector<std::string> Dependencies;
+
+    //true if the PCH and its deps file exist and none of the files it was built from changed (only the files whose
+    //size or mtime changed are hashed ; watch mode calls it at each regeneration)
+    bool isUpToDate();
+
+public:
+    //ctor
+    PrecompiledPrefix(llvm::StringRef CacheDir, const std::vector<std::string> &Headers,
+                      const std::vector<std::string> &Flags);
+
+    // the system headers included by a .c file before anything else, in source order: its leading #include <...>
+    // lines (comments and blank lines are skipped ; the code after a comment on the same line is scanned). the scan
+    // stops at the first other line: an #include "...", any other directive (ex: #define _GNU_SOURCE can change what
+    // the next headers declare) or code.
+    // it is a textual scan: no preprocessor involved
+    static std::vector<std::string> scanLeadingSystemHeaders(const std::string &SourceFile);
+
+    //true if a .c file that includes first the headers LeadingHeaders can use the PCH: the headers of the PCH must
+    //be its first headers, in the same order (a header can depend on the macros and types of the previous ones)
+    bool canBeUsedBy(const std::vector<std::string> &LeadingHeaders) const;
+
+    //reuses the PCH if it is up to date, builds it otherwise ; returns false if the PCH cant be built
+    bool prepare(const std::vector<std::string> &Flags);
+
+    //the compilation flags of the .c files that use the PCH
+    //clang's own check of the PCH inputs (mtime + size) is disabled: isUpToDate() already checked their content
+    std::vector<std::string> getFlags(const std::vector<std::string> &Flags) const;
+
+    const std::vector<std::string> &getDependencies() const;
+};
+
+
+// StatsCollector : collects the TranslationUnitInfo of all the .c files of a run (--stats) ;
+// its methods are thread safe
+// members: Infos
+class StatsCollector {
+private:
+    std::vector<TranslationUnitInfo> Infos;
+    std::mutex Mutex;
+
+public:
+    void add(const TranslationUnitInfo &Info);
+
+    // writes the stats as JSON: one object per .c file in "files", and their sums in "totals"
+    // (sums of runs can be aggregated by adding their "totals")
+    bool write(llvm::StringRef FileName);
+
+    // prints the totals
+    void printSummary(llvm::raw_ostream &OS);
+
+    // writes the manifest of a shard (--manifest) as JSON: the shard, then one object per .c file in "files"
+    // (input, output, hash of the output, status, duration, diagnostics) ; see mergeManifests
+    bool writeManifest(llvm::StringRef FileName, unsigned Shard, unsigned Shards);
+};
+
+
+
+
+/*-----------------------------------------------------------------------------------------------*/
+/* functions (header_generator.cpp)                                                            */
+/*-----------------------------------------------------------------------------------------------*/
+
+// InMemoryHeader : the result of generateHeaderInMemory
+struct InMemoryHeader {
+    bool Success = false;
+    std::string Content; //the .h file
+    std::string Diagnostics; //the compiler errors and warnings, as printed by clang
+    TranslationUnitInfo Info;
+};
+
+// the compilation flags of the .c files ; CPlusPlus: of the C++ files
+std::vector<std::string> getCompilationFlags(bool CPlusPlus = false);
+
+// builds (or reuses) the PCH of the system headers that at least half of the C SourceFiles include first, in the same
+// order, in PCHDir (the C++ files dont use the PCH)
+// returns nothing if there is no such header or if the PCH cant be built ;
+// UsesPrefix[i] is set to true if SourceFiles[i] can use the PCH
+std::unique_ptr<PrecompiledPrefix> preparePrecompiledPrefix(llvm::StringRef PCHDir,
+                                                            const std::vector<std::string> &SourceFiles,
+                                                            const std::vector<std::string> &Flags,
+                                                            std::vector<bool> &UsesPrefix);
+
+// derives the .h file name from the .c file name: my_file.c -> my_file.h
+std::string deriveHeaderFileName(const std::string &InputFile);
+
+// the output file of a .c file: its .h file, or its .cppm file (--emit-module)
+std::string deriveOutputFileName(const std::string &InputFile, const GeneratorOptions &Options);
+
+// writes a depfile (Make/Ninja format) "Target: Prerequisites..." ; the paths are escaped for Make
+// (spaces, '#' and '$') ; returns false if the depfile cant be written
+bool writeDepfile(llvm::StringRef DepfileName, llvm::StringRef Target, const std::vector<std::string> &Prerequisites);
+
+// adds InputPath to SourceFiles ; if InputPath is a directory: adds all the .c files found in it (recursively)
+// returns false if InputPath can't be read
+bool collectSourceFiles(const std::string &InputPath, std::vector<std::string> &SourceFiles);
+
+// removes the .c files given twice (ex: src src/a.c, or a.c ./a.c): two paths that resolve to the same file are the
+// same .c file ; the first spelling is kept, in the order of the typed command
+void removeDuplicateSourceFiles(std::vector<std::string> &SourceFiles);
+
+// runs the HeaderGeneratorFrontendAction on a single .c file and writes the .h file HFileName
+// if a Cache is given: the .c file isnt parsed if its .h file is up to date
+// can be called from several threads at the same time
+// if Stats is given: the TranslationUnitInfo of the .c file is added to it
+// if Options.WriteDepfile: the depfile of the .h file is written (even if the .h file is up to date)
+// if Umbrella is given: the declarations are added to it, no .h file is written (--umbrella)
+// if StatCache is given: the file system lookups of the parser go through it (--stat-cache)
+int generateHeader(const clang::tooling::CompilationDatabase &Compilations, const std::string &InputFile,
+                   const std::string &HFileName, const GeneratorOptions &Options, HeaderCache *Cache,
+                   StatsCollector *Stats, UmbrellaStore *Umbrella = nullptr, SharedStatCache *StatCache = nullptr);
+
+// batch mode: runs generateHeader on each .c file on a pool of threads (one thread per core by default) ;
+// a failing .c file is reported at the end and doesnt stop the others
+// compilationsFor(i): the compilation database of SourceFiles[i]
+int generateHeaders(const std::vector<std::string> &SourceFiles,
+                    const std::function<const clang::tooling::CompilationDatabase &(size_t)> &compilationsFor,
+                    const GeneratorOptions &Options, HeaderCache *Cache, StatsCollector *Stats, unsigned Jobs,
+                    UmbrellaStore *Umbrella = nullptr, SharedStatCache *StatCache = nullptr);
+
+// sharded mode (--shard i/N): the SourceFiles of the shard Shard (0 based) out of Shards ; every node running with the
+// same SourceFiles (and TimingsFile) gets a disjoint part of them:
+//      - without TimingsFile: a .c file goes to the shard xxh3(path) % Shards
+//      - with TimingsFile (a manifest of a previous run): the .c files are balanced on the shards by their previous
+//        duration (longest first, on the least loaded shard) ; a new .c file, or a .c file cached in the previous run,
+//        is estimated from its size
+// returns nothing if TimingsFile cant be read
+std::optional<std::vector<std::string>> selectShard(std::vector<std::string> SourceFiles, unsigned Shard,
+                                                    unsigned Shards, llvm::StringRef TimingsFile);
+
+// merges the manifests of all the shards of a run into OutputFile (--merge-manifests). they are validated: same
+// number of shards, each shard once, each .c file in one shard only, no failed .c file, and the .h files found on
+// this node have the hash of their manifest. OutputFile is only written if they are ; returns 0 if they are
+int mergeManifests(llvm::StringRef OutputFile, const std::vector<std::string> &ManifestFiles);
+
+// in-memory API (libheadergen): generates the .h file of a .c source given as text ; nothing is read from or written
+// to the disk but the system headers: the source (as FileName) and the VirtualFiles (path -> content, ex: headers
+// made by a code generator) are files of an in-memory file system laid over the real one. Sink receives the .h file
+// (HFileName is only used for the header guard). can be called from several threads at the same time
+bool generateHeaderInMemory(llvm::StringRef Source, llvm::StringRef FileName, llvm::StringRef HFileName,
+                            const std::vector<std::string> &Flags, const GeneratorOptions &Options,
+                            const HeaderSink &Sink, const std::map<std::string, std::string> &VirtualFiles = {},
+                            std::string *Diagnostics = nullptr, TranslationUnitInfo *Info = nullptr);
+
+// same, returns the .h file content
+InMemoryHeader generateHeaderInMemory(llvm::StringRef Source, llvm::StringRef FileName, llvm::StringRef HFileName,
+                                      const std::vector<std::string> &Flags = getCompilationFlags(),
+                                      const GeneratorOptions &Options = GeneratorOptions(),
+                                      const std::map<std::string, std::string> &VirtualFiles = {});
+
+// TraversalMode : what parseAndTraverse does with the AST of a .c file
+enum class TraversalMode {
+    None,   //nothing (the parse phase of the benchmark)
+    Pruned, //the top level declarations of the .c file, as generateHeader does
+    Full    //the whole translation unit: the declarations of the included headers too (--full-traversal)
+};
+
+// benchmark hook (generate_header_bench: parse and traverse phases): builds the AST of InputFile as generateHeader
+// does and collects its functions declarations as Mode says ; no .h file is written.
+// returns the number of declarations collected, nothing if the .c file cant be parsed
+std::optional<size_t> parseAndTraverse(const clang::tooling::CompilationDatabase &Compilations,
+                                       const std::string &InputFile, const GeneratorOptions &Options,
+                                       TraversalMode Mode);
+
+} // namespace headergen
+
+#endif // HEADER_GENERATOR_H_
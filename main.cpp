@@ -1,249 +1,190 @@
-#include "clang/Frontend/FrontendActions.h"
-#include "clang/Tooling/CommonOptionsParser.h" //to use: clang::tooling::FixedCompilationDatabase
-#include "clang/Tooling/Tooling.h"
-#include "clang/AST/ASTConsumer.h"
-#include "clang/AST/RecursiveASTVisitor.h"
-#include "clang/Frontend/CompilerInstance.h"
-#include "clang/Lex/PPCallbacks.h" //used by include collector
-#include "clang/Lex/Preprocessor.h" //used by include collector
-
-
-#include <set>
-#include <string>
-#include <fstream>
-#include <vector>
-
-using namespace clang;
+#include "header_generator.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TimeProfiler.h" //used by --time-trace
+
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h> //used by the watch mode
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
 using namespace clang::tooling;
 using namespace llvm;
+using namespace headergen;
 
 /*-----------------------------------------------------------------------------------------------*/
-/* classes                                                                             */
+/* classes                                                                             */
 /*-----------------------------------------------------------------------------------------------*/
 
-// IncludeCollector : A preprocessor callbacks set that finds and stores all #include directives in its member: RequiredHeaders
-class IncludeCollector : public PPCallbacks {
+#ifdef __linux__
+// SourceWatcher : the loop of the watch mode (--watch). it waits for:
+//      - inotify events: a .c file was written in a watched directory (editors save with a write or a rename)
+//      - requests on stdin: one .c file path per line ; "quit" stops the loop
+// and calls Regenerate on the .c file. a stdin request gets a reply line: "ok <file>" or "error <file>"
+// members: InotifyFD, WatchedDirs (inotify watch descriptor -> directory), WatchedFiles, Regenerate
+class SourceWatcher {
 private:
-    std::set<std::string> &RequiredHeaders;
-    const SourceManager &SM;
-
-public:
-    //ctor
-    explicit IncludeCollector(std::set<std::string> &headers, const SourceManager &SM) : RequiredHeaders(headers), SM(SM) {}
-
-    // This callback is triggered for every #include directive.
-    // It will be called by the Preprocessor when it encounters an #include.
-    void InclusionDirective(SourceLocation HashLoc,
-                            const Token &IncludeTok,
-                            StringRef FileName,
-                            bool IsAngled,
-                            CharSourceRange FilenameRange,
-                            OptionalFileEntryRef File,
-                            StringRef SearchPath,
-                            StringRef RelativePath,
-                            const clang::Module *SuggestedModule,
-                            bool ModuleImported,
-                            SrcMgr::CharacteristicKind FileType) override {
-
-        if (SM.isInMainFile(HashLoc)) //collect only the includes which # is in the .c file
-        {
-        // Collect the header name in the correct format (<...> or "...").
-        std::string headerStr = IsAngled ? "<" + FileName.str() + ">" : "\"" + FileName.str() + "\"";
-        RequiredHeaders.insert(headerStr);
+    int InotifyFD;
+    std::map<int, std::string> WatchedDirs;
+    //.c files given in the typed command: (watch descriptor of their directory, file name) -> the path as typed ;
+    //empty: all the .c files of the watched dirs
+    std::map<std::pair<int, std::string>, std::string> WatchedFiles;
+    std::function<int(const std::string &)> Regenerate;
+
+    static constexpr uint32_t EventMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+
+    //watches Dir and its sub directories
+    void watchDirectory(const std::string &Dir) {
+        int WD = inotify_add_watch(InotifyFD, Dir.c_str(), EventMask);
+        if (WD < 0) {
+            errs() << "Error: Could not watch directory " << Dir << "\n";
+            return;
         }
-    }
+        WatchedDirs.emplace(WD, Dir); //a directory given twice keeps its first spelling
 
-    const std::set<std::string>& getHeaders() const {
-        return RequiredHeaders;
+        std::error_code EC;
+        for (llvm::sys::fs::directory_iterator It(Dir, EC), End; It != End && !EC; It.increment(EC)) {
+            if (It->type() == llvm::sys::fs::file_type::directory_file) {
+                watchDirectory(It->path());
+            }
+        }
     }
-};
-
-
-
-
-// FunctionDeclCollector : an AST visitor that parses the AST of the .c file and:
-//      - collects functions declarations and stores them as a string set in the member: FunctionDeclarations
-//
-// when the (inherited) method: TraverseDecl() is called, it parses the AST and executes 
-// the cb: VisitFunctionDecl() each time it encounters a function declaration. This cb does the processing (aka:
-// populating FunctionDeclarations and RequiredHeaders)
-// members: Context (from Tool), FunctionDeclarations, MainFilePath (from Tool)
-class FunctionDeclCollector : public RecursiveASTVisitor<FunctionDeclCollector> {
-private:
-    ASTContext &Context; //AST + other things
-    std::set<std::string> FunctionDeclarations;
-    std::string MainFilePath;
 
-public:
-    //constructor
-    explicit FunctionDeclCollector(ASTContext &Context, StringRef MainFile)
-        : Context(Context), MainFilePath(MainFile.str()) {}
-
-    // cb; 
-    // there is an inherited method: Visitor.TraverseDecl(); 
-    // when it's called as Visitor.TraverseDecl(Context.getTranslationUnitDecl()): this cb is executed each time
-    // the visitor (this object) encounters a function declaration in the AST
-    bool VisitFunctionDecl(FunctionDecl *F) {
-        
-        // leave the cb if the declaration isnt in MainFile (could be included from another file 
-        // after the preprocessing)
-        if (!Context.getSourceManager().isInMainFile(F->getLocation())) {
-            return true;
-        }
+    //reads the pending inotify events and returns the .c files that were written
+    std::set<std::string> readEvents() {
+        std::set<std::string> Changed;
+        alignas(struct inotify_event) char Buffer[4096];
+        ssize_t Length = read(InotifyFD, Buffer, sizeof(Buffer));
+        for (char *Ptr = Buffer; Length > 0 && Ptr < Buffer + Length;) {
+            const struct inotify_event *Event = reinterpret_cast<const struct inotify_event *>(Ptr);
+            Ptr += sizeof(struct inotify_event) + Event->len;
+
+            auto Dir = WatchedDirs.find(Event->wd);
+            if (Dir == WatchedDirs.end() || Event->len == 0) {
+                continue;
+            }
+            SmallString<256> Path(Dir->second);
+            llvm::sys::path::append(Path, Event->name);
 
-        // Get the PrintingPolicy from the AST context to get source-level type names
-        const PrintingPolicy &PP = Context.getPrintingPolicy();
-
-        //get function name and return type and storage class
-        std::string ReturnType = F->getReturnType().getAsString(PP);
-        std::string FunctionName = F->getNameAsString();
-        std::string ParamsStr;
-        std::string StorageClass = ""; //storage class can be: static or extern
-        
-        if (F->getStorageClass() == SC_Static) {
-            StorageClass = "static ";
-        }
-        else 
-        if (F->getStorageClass() == SC_Extern)
-        {
-            StorageClass = "extern ";
-        }
-        
-        //fill the ParamsStr
-        for (unsigned i = 0; i < F->getNumParams(); ++i) 
-        {
-            ParmVarDecl *Param = F->getParamDecl(i);
-            
-            ParamsStr += Param->getType().getAsString(PP);
-            if (!Param->getNameAsString().empty()) {
-                ParamsStr += " ";
-                ParamsStr += Param->getNameAsString();
+            //a new sub directory: watch it too
+            if ((Event->mask & IN_ISDIR) && (Event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                watchDirectory(Path.str().str());
+                continue;
             }
-            if (i < F->getNumParams() - 1) {
-                ParamsStr += ", ";
+            //IN_CREATE alone: the file is still empty, wait for its IN_CLOSE_WRITE
+            if (!(Event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) {
+                continue;
             }
-        }
-
-        // A function is variadic only if it explicitly has '...' in its declaration.
-        if (F->isVariadic()) {
-             if (!ParamsStr.empty()) {
-                ParamsStr += ", ";
+            //watched dirs: their .c files ; watched files: .c or C++ files, regenerated under the path typed in the
+            //command, as in the first run (the header guard, the cache and the manifest entries depend on it)
+            if (WatchedFiles.empty()) {
+                if (llvm::sys::path::extension(Path) == ".c") {
+                    Changed.insert(Path.str().str());
+                }
+                continue;
+            }
+            auto File = WatchedFiles.find({Event->wd, std::string(Event->name)});
+            if (File != WatchedFiles.end()) {
+                Changed.insert(File->second);
             }
-            ParamsStr += "...";
         }
-
-
-        std::string declaration = StorageClass + ReturnType + " " + FunctionName + "(" + ParamsStr + ");";
-        FunctionDeclarations.insert(declaration);
-
-        return true;
+        return Changed;
     }
 
-    const std::set<std::string>& getDeclarations() const {
-        return FunctionDeclarations;
-    }
-
-};
-
-// HeaderGeneratorConsumer : an AST consumer that :
-//      - 
-// members: Visitor, OutputFilePath (Visitor is a FunctionDeclCollector), CI, RequiredHeaders
-class HeaderGeneratorConsumer : public ASTConsumer {
-private:
-    FunctionDeclCollector Visitor;
-    std::string OutputFilePath;
-    CompilerInstance &CI;
-    std::set<std::string> RequiredHeaders;
-
 public:
     //ctor
-    explicit HeaderGeneratorConsumer(CompilerInstance &CI, StringRef MainFile, StringRef OutputFile)
-        : Visitor(CI.getASTContext(), MainFile), OutputFilePath(OutputFile.str()), CI(CI)
-    {
-        // Register the IncludeCollector as a preprocessor callback
-        // This is the correct way to pass ownership of the unique_ptr
-        CI.getPreprocessor().addPPCallbacks(std::make_unique<IncludeCollector>(RequiredHeaders, CI.getSourceManager()));
-    }
-
-    //this method uses the visitor to collect declarations and store them in the member: FunctionDeclarations
-    //then writes them into a .h file and adds the headerguard
-    void HandleTranslationUnit(ASTContext &Context) override {
-        Visitor.TraverseDecl(Context.getTranslationUnitDecl());
+    explicit SourceWatcher(std::function<int(const std::string &)> Regenerate)
+        : InotifyFD(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), Regenerate(std::move(Regenerate)) {}
 
-        std::vector<std::string> declarations(Visitor.getDeclarations().begin(), Visitor.getDeclarations().end());
-        std::sort(declarations.begin(), declarations.end());
-
-        std::ofstream HeaderFile(OutputFilePath);
-        if (!HeaderFile.is_open()) {
-            errs() << "Error: Could not open output file " << OutputFilePath << "\n";
-            return;
+    ~SourceWatcher() {
+        if (InotifyFD >= 0) {
+            close(InotifyFD);
         }
+    }
 
-        std::string HeaderGuard = OutputFilePath;
-        std::transform(HeaderGuard.begin(), HeaderGuard.end(), HeaderGuard.begin(), ::toupper);
-        std::replace(HeaderGuard.begin(), HeaderGuard.end(), '.', '_');
-        std::replace(HeaderGuard.begin(), HeaderGuard.end(), '-', '_');
-        std::replace(HeaderGuard.begin(), HeaderGuard.end(), '/', '_');
-        std::replace(HeaderGuard.begin(), HeaderGuard.end(), '\\', '_');
-        HeaderGuard += "_";
-
-        HeaderFile << "#ifndef " << HeaderGuard << "\n";
-        HeaderFile << "#define " << HeaderGuard << "\n\n";
-
-    
-        //write all the collected headers from the .c in the .h
-        for (const auto &header : RequiredHeaders)
-        {
-            HeaderFile << "#include " << header << "\n";
+    //watches a directory (recursively), or the directory of a .c file
+    bool watch(const std::string &InputPath) {
+        if (InotifyFD < 0) {
+            return false;
         }
-        
-        HeaderFile << "\n";
-        
-        for (const std::string& decl : declarations) {
-            HeaderFile << decl << "\n";
+        if (llvm::sys::fs::is_directory(InputPath)) {
+            watchDirectory(InputPath);
+            return true;
         }
 
-        HeaderFile << "\n#endif // " << HeaderGuard << "\n";
-
-        HeaderFile.close();
-
-        outs() << "Generated " << OutputFilePath << " successfully.\n";
-    }
-};
-
-
-// HeaderGeneratorFrontendAction : an AST Frontend Action that can:
-//      - create an object from class: HeaderGeneratorConsumer (the one that creates the .h file)
-//      - set the compilator to use C17
-// members: OutputFilePath
-class HeaderGeneratorFrontendAction : public ASTFrontendAction {
-private:
-    std::string OutputFilePath;
-
-public:
-    HeaderGeneratorFrontendAction(StringRef OutputFile) : OutputFilePath(OutputFile.str()) {}
-
-    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, StringRef InFile) override {
-        CI.getLangOpts().C17 = true;
-        CI.getLangOpts().CPlusPlus = false;
-        return std::make_unique<HeaderGeneratorConsumer>(CI, InFile, OutputFilePath);
+        //a file: watch its directory (a rename replaces the file, its own watch would be lost)
+        SmallString<256> Dir = llvm::sys::path::parent_path(InputPath);
+        if (Dir.empty()) {
+            Dir = ".";
+        }
+        int WD = inotify_add_watch(InotifyFD, Dir.c_str(), EventMask);
+        if (WD < 0) {
+            return false;
+        }
+        WatchedDirs.emplace(WD, Dir.str().str());
+        //keyed by the watch descriptor: two spellings of the directory (f1.c, ./f1.c) give the same one ; a file given
+        //twice keeps its first spelling, the one kept by removeDuplicateSourceFiles
+        WatchedFiles.emplace(std::make_pair(WD, llvm::sys::path::filename(InputPath).str()), InputPath);
+        return true;
     }
-};
-
 
-// HeaderGeneratorFrontendActionFactory : can create a HeaderGeneratorFrontendAction
-// members: OutputFilePath
-class HeaderGeneratorFrontendActionFactory : public FrontendActionFactory {
-private:
-    std::string OutputFilePath;
+    //the loop: returns when "quit" is read on stdin
+    int run() {
+        outs() << "Watching " << WatchedDirs.size() << " directories.\n";
+        outs().flush();
+
+        bool StdinOpen = true;
+        std::string PendingInput;
+        while (true) {
+            struct pollfd FDs[2] = {{InotifyFD, POLLIN, 0}, {StdinOpen ? STDIN_FILENO : -1, POLLIN, 0}};
+            if (poll(FDs, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                errs() << "Error: poll failed\n";
+                return 1;
+            }
 
-public:
-    HeaderGeneratorFrontendActionFactory(StringRef OutputFile) : OutputFilePath(OutputFile.str()) {}
+            if (FDs[0].revents & POLLIN) {
+                for (const std::string &File : readEvents()) {
+                    Regenerate(File);
+                }
+                outs().flush();
+            }
 
-    std::unique_ptr<FrontendAction> create() override {
-        return std::make_unique<HeaderGeneratorFrontendAction>(OutputFilePath);
+            if (FDs[1].revents & (POLLIN | POLLHUP)) {
+                char Buffer[4096];
+                ssize_t Length = read(STDIN_FILENO, Buffer, sizeof(Buffer));
+                if (Length <= 0) {
+                    StdinOpen = false; //no more requests: keep watching the directories
+                    continue;
+                }
+                PendingInput.append(Buffer, Length);
+
+                //handle the complete lines: each one is a request
+                size_t EndOfLine;
+                while ((EndOfLine = PendingInput.find('\n')) != std::string::npos) {
+                    std::string Request = StringRef(PendingInput).take_front(EndOfLine).trim().str();
+                    PendingInput.erase(0, EndOfLine + 1);
+                    if (Request.empty()) {
+                        continue;
+                    }
+                    if (Request == "quit") {
+                        return 0;
+                    }
+                    outs() << (Regenerate(Request) == 0 ? "ok " : "error ") << Request << "\n";
+                    outs().flush();
+                }
+            }
+        }
     }
 };
+#endif
 
 
 
@@ -256,103 +197,418 @@ public:
 // generate_header_tool my_file.c
 // OR
 // generate_header_tool my_file.c -o my_wow_file.h
+// OR (batch mode: a .h file is generated next to each .c file ; directories are searched recursively for .c files)
+// generate_header_tool my_file.c other_file.c src_dir/ [-j 8]
+// (a .c file can also be a C++ file: .cpp, .cc or .cxx ; it is parsed as C++20)
+// any of them can be followed by: --cache my_cache_file (skip the .c files that didnt change since the last run)
+//                                   --stat-cache my_stat_cache_file (share the file lookups of the parsers, and keep the
+//                                                                    missing files between runs ; see SharedStatCache)
+//                                   --skip-bodies (dont parse the functions bodies)
+//                                   --minimal-includes (only the #include lines needed by the declarations)
+//                                   --emit-module (write a C++20 module interface unit my_file.cppm instead of the .h file)
+//                                   --engine lexer|ast (lexer: read the .c files with a raw lexer only, without parsing
+//                                                       them ; see LexerDeclExtractor. ast: the default)
+//                                   --verify (run both engines, write the .h file of the AST engine and report the
+//                                             .c files where they disagree)
+//                                   -MD (write a depfile next to each .h file: my_file.h.d)
+//                                   -MF my_depfile.d (the depfile name, single .c file)
+//                                   --pch-dir my_pch_dir (precompile the system headers included by most .c files)
+//                                   --watch (after the first run: regenerate the .h file of a .c file each time it is
+//                                            saved, or requested on stdin ; see SourceWatcher)
+//                                   --time-trace my_trace.json (Chrome trace of the phases of each .c file)
+//                                   --time-trace-granularity 0 (the shortest span recorded in the trace, in us)
+//                                   --stats my_stats.json (counters and durations of each .c file, and their totals)
+//                                   --shard i/N (only the part i of N of the .c files ; see selectShard)
+//                                   --shard-timings previous_manifest.json (balance the shards on the previous durations)
+//                                   --manifest my_manifest.json (the .c files of the run, their .h files hashes, ...)
+// OR (library mode: one umbrella header with the functions of all the .c files, instead of a .h file per .c file)
+// generate_header_tool my_file.c other_file.c src_dir/ --umbrella my_lib.h [-j 8] [--minimal-includes] [--stats ...]
+// OR (merge the manifests of all the shards of a run)
+// generate_header_tool --merge-manifests merged.json shard_0.json shard_1.json ...
 int main(int argc, const char **argv) {
+
+    if (argc >= 3 && StringRef(argv[1]) == "--merge-manifests") {
+        return mergeManifests(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+    }
     
-    // checks if the .c file is mentionned in the typed command
-    if (argc < 2) {
+    std::vector<std::string> InputPaths;
+    std::vector<std::string> SourceFiles;
+    std::string HFileName;
+    std::string CacheFileName;
+    std::string StatCacheFileName;
+    std::string PCHDir;
+    std::string TimeTraceFileName;
+    std::string StatsFileName;
+    std::string ManifestFileName;
+    std::string ShardTimingsFileName;
+    std::string ShardSpec; //i/N
+    std::string UmbrellaFileName;
+    GeneratorOptions Options;
+    unsigned Jobs = 0; //0: use all the cores
+    bool Watch = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string Arg = argv[i];
+
+        //an option followed by a value cant be the last argv parameter (its value isnt a .c file)
+        bool TakesValue = StringSwitch<bool>(Arg)
+                              .Cases("-o", "-j", "-MF", "--cache", "--stat-cache", "--pch-dir", "--stats", true)
+                              .Cases("--time-trace", "--time-trace-granularity", "--shard", "--shard-timings", true)
+                              .Cases("--manifest", "--engine", "--umbrella", true)
+                              .Default(false);
+        if (TakesValue && i + 1 >= argc) {
+            errs() << "Error: Missing value for " << Arg << ".\n";
+            return 1;
+        }
+
+        //if there is "-o" in the argv : take the following argv parameter as the HFileName
+        if (Arg == "-o") {
+            HFileName = argv[++i];
+        }
+        //if there is "-j" in the argv : take the following argv parameter as the number of parallel jobs
+        else
+        if (Arg == "-j") {
+            if (StringRef(argv[++i]).getAsInteger(10, Jobs)) {
+                errs() << "Error: -j expects a number of jobs, got " << argv[i] << ".\n";
+                return 1;
+            }
+        }
+        else
+        if (Arg == "-MD") {
+            Options.WriteDepfile = true;
+        }
+        //if there is "-MF" in the argv : take the following argv parameter as the depfile name (implies -MD)
+        else
+        if (Arg == "-MF") {
+            Options.DepfileName = argv[++i];
+            Options.WriteDepfile = true;
+        }
+        //if there is "--cache" in the argv : take the following argv parameter as the cache file name
+        else
+        if (Arg == "--cache") {
+            CacheFileName = argv[++i];
+        }
+        //if there is "--stat-cache" in the argv : take the following argv parameter as the stat cache file name
+        else
+        if (Arg == "--stat-cache") {
+            StatCacheFileName = argv[++i];
+        }
+        //if there is "--pch-dir" in the argv : take the following argv parameter as the PCH cache directory
+        else
+        if (Arg == "--pch-dir") {
+            PCHDir = argv[++i];
+        }
+        //if there is "--time-trace" in the argv : take the following argv parameter as the trace file name
+        else
+        if (Arg == "--time-trace") {
+            TimeTraceFileName = argv[++i];
+            Options.TimeTrace = true;
+        }
+        //if there is "--time-trace-granularity" in the argv : the following argv parameter is the minimum duration (us)
+        //of a recorded span
+        else
+        if (Arg == "--time-trace-granularity") {
+            if (StringRef(argv[++i]).getAsInteger(10, Options.TimeTraceGranularity)) {
+                errs() << "Error: --time-trace-granularity expects a duration in microseconds, got " << argv[i] << ".\n";
+                return 1;
+            }
+        }
+        //if there is "--shard" in the argv : take the following argv parameter (or the one after "=") as i/N
+        else
+        if (Arg == "--shard") {
+            ShardSpec = argv[++i];
+        }
+        else
+        if (StringRef(Arg).starts_with("--shard=")) {
+            ShardSpec = Arg.substr(Arg.find('=') + 1);
+        }
+        else
+        if (Arg == "--shard-timings") {
+            ShardTimingsFileName = argv[++i];
+        }
+        else
+        if (Arg == "--manifest") {
+            ManifestFileName = argv[++i];
+        }
+        //if there is "--stats" in the argv : take the following argv parameter as the stats file name
+        else
+        if (Arg == "--stats") {
+            StatsFileName = argv[++i];
+        }
+        else
+        if (Arg == "--skip-bodies") {
+            Options.SkipFunctionBodies = true;
+        }
+        else
+        if (Arg == "--emit-module") {
+            Options.EmitModule = true;
+        }
+        else
+        if (Arg == "--minimal-includes") {
+            Options.MinimalIncludes = true;
+        }
+        //if there is "--engine" in the argv : take the following argv parameter (or the one after "=") as the engine
+        else
+        if (Arg == "--engine" || StringRef(Arg).starts_with("--engine=")) {
+            std::string Engine = Arg == "--engine" ? argv[++i] : Arg.substr(Arg.find('=') + 1);
+            if (Engine != "lexer" && Engine != "ast") {
+                llvm::errs() << "Error: --engine expects lexer or ast, got " << Engine << ".\n";
+                return 1;
+            }
+            Options.Engine = Engine == "lexer" ? ExtractionEngine::Lexer : ExtractionEngine::AST;
+        }
+        else
+        if (Arg == "--verify") {
+            Options.Verify = true;
+        }
+        //if there is "--umbrella" in the argv : take the following argv parameter as the umbrella header name
+        else
+        if (Arg == "--umbrella") {
+            UmbrellaFileName = argv[++i];
+        }
+        else
+        if (Arg == "--watch") {
+            Watch = true;
+        }
+        //an unknown option is an error (it would be taken for a .c file)
+        else
+        if (StringRef(Arg).starts_with("-")) {
+            errs() << "Error: Unknown option " << Arg << ".\n";
+            return 1;
+        }
+        //any other arg is a .c file or a directory containing .c files
+        else {
+            if (!collectSourceFiles(Arg, SourceFiles)) {
+                return 1;
+            }
+            InputPaths.push_back(Arg);
+        }
+    }
+    //a .c file given twice (by its directory and by its name, or with two spellings) is generated once
+    removeDuplicateSourceFiles(SourceFiles);
+
+    // checks if a .c file is mentionned in the typed command
+    if (SourceFiles.empty()) {
         llvm::errs() << "Error: No source file specified.\n";
         return 1;
     }
 
-    //1st arg is the InputFile
-    std::string InputFile = argv[1];
-    std::string HFileName;
+    // "-o" names a single .h file: it can't be used with several .c files
+    if (!HFileName.empty() && (SourceFiles.size() > 1 || Watch)) {
+        llvm::errs() << "Error: -o can only be used with a single source file, without --watch.\n";
+        return 1;
+    }
+    if (!Options.DepfileName.empty() && SourceFiles.size() > 1) {
+        llvm::errs() << "Error: -MF can only be used with a single source file (use -MD).\n";
+        return 1;
+    }
+    //--umbrella: every .c file is parsed (a cached .c file would have no declarations) and there is no .h file per .c file
+    if (!UmbrellaFileName.empty() && (!HFileName.empty() || Options.WriteDepfile || !CacheFileName.empty() || Watch ||
+                                      Options.EmitModule)) {
+        llvm::errs() << "Error: --umbrella cant be used with -o, -MD, -MF, --cache, --watch or --emit-module.\n";
+        return 1;
+    }
 
-    //if there is "-o" in the argv : take the following argv parameter as the HFileName
-    for (int i = 1; i < argc; ++i) {
-        if (std::string(argv[i]) == "-o" && i + 1 < argc) {
-            HFileName = argv[i + 1];
-            break;
+    //--shard i/N: only the .c files of the shard i (0 based) are generated
+    unsigned Shard = 0, Shards = 1;
+    if (!ShardSpec.empty()) {
+        auto [ShardIndex, ShardCount] = StringRef(ShardSpec).split('/');
+        if (ShardIndex.getAsInteger(10, Shard) || ShardCount.getAsInteger(10, Shards) || Shards == 0 || Shard >= Shards) {
+            llvm::errs() << "Error: --shard expects i/N with 0 <= i < N, got " << ShardSpec << ".\n";
+            return 1;
+        }
+    }
+    if (!ShardSpec.empty() || !ShardTimingsFileName.empty()) {
+        std::optional<std::vector<std::string>> ShardFiles = selectShard(SourceFiles, Shard, Shards, ShardTimingsFileName);
+        if (!ShardFiles) {
+            return 1;
+        }
+        outs() << "Shard " << Shard << "/" << Shards << ": " << ShardFiles->size() << " of " << SourceFiles.size()
+               << " .c files.\n";
+        SourceFiles = std::move(*ShardFiles);
+
+        //an empty shard (more shards than .c files): nothing to generate, its manifest is still needed by the merge
+        if (SourceFiles.empty()) {
+            if (!ManifestFileName.empty() && !StatsCollector().writeManifest(ManifestFileName, Shard, Shards)) {
+                return 1;
+            }
+            return 0;
         }
     }
 
+    //CWD: current working directory : where to find the src files
+    std::string CWD = ".";
+    std::vector<std::string> Flags = getCompilationFlags();
+
+    //the FixedCompilationDatabase is only read by the tools: it is shared by all the .c files
+    clang::tooling::FixedCompilationDatabase Compilations(CWD, Flags);
+    //the C++ files (.cpp, .cc, .cxx) have their own flags (C++20) ; they dont use the PCH (it is a C one)
+    clang::tooling::FixedCompilationDatabase CXXCompilations(CWD, getCompilationFlags(true));
+
     //if the .h file name isnt mentioned in the typed comman, derive it from the .c file name.
     if (HFileName.empty()) {
-        size_t dot_pos = InputFile.rfind('.');
-        if (dot_pos != std::string::npos) {
-            HFileName = InputFile.substr(0, dot_pos) + ".h";
-        } else {
-            HFileName = InputFile + ".h";
+        HFileName = deriveOutputFileName(SourceFiles[0], Options);
+    }
+
+    //--time-trace: the main thread's profiler also receives the spans of the worker threads
+    if (Options.TimeTrace) {
+        timeTraceProfilerInitialize(Options.TimeTraceGranularity, "generate_header_tool");
+    }
+    std::unique_ptr<StatsCollector> Stats;
+    if (!StatsFileName.empty() || !ManifestFileName.empty()) {
+        Stats = std::make_unique<StatsCollector>();
+    }
+
+    std::unique_ptr<HeaderCache> Cache;
+    if (!CacheFileName.empty()) {
+        //the options that change the content of the .h files are part of the cache key
+        std::vector<std::string> CacheFlags = Flags;
+        if (Options.MinimalIncludes) {
+            CacheFlags.push_back("--minimal-includes");
+        }
+        if (Options.EmitModule) {
+            CacheFlags.push_back("--emit-module");
+        }
+        //a .h file of the lexer engine isnt always the one of the AST engine ; a --verify run checks every .c file
+        if (Options.Engine == ExtractionEngine::Lexer) {
+            CacheFlags.push_back("--engine=lexer");
         }
+        if (Options.Verify) {
+            CacheFlags.push_back("--verify");
+        }
+        Cache = std::make_unique<HeaderCache>(CacheFileName, CacheFlags);
+        Cache->load();
     }
 
+    //PCH: precompile the system headers that at least half of the .c files include first, in the same order ;
+    //the .c files that start with these includes are compiled with the PCH, the others without it
+    std::vector<bool> UsesPrefix(SourceFiles.size(), false);
+    std::unique_ptr<PrecompiledPrefix> Prefix;
+    std::unique_ptr<clang::tooling::FixedCompilationDatabase> PrefixCompilations;
+    if (!PCHDir.empty()) {
+        llvm::TimeTraceScope Span("PreparePCH", PCHDir);
+        Prefix = preparePrecompiledPrefix(PCHDir, SourceFiles, Flags, UsesPrefix);
+    }
+    if (Prefix) {
+        PrefixCompilations = std::make_unique<clang::tooling::FixedCompilationDatabase>(CWD, Prefix->getFlags(Flags));
+        if (Cache) {
+            Cache->setCommonDependencies(Prefix->getDependencies());
+        }
+        Options.CommonDependencies = Prefix->getDependencies();
+    }
+    auto compilationsFor = [&](size_t i) -> const CompilationDatabase & {
+        if (isCXXSourceFile(SourceFiles[i])) {
+            return CXXCompilations;
+        }
+        return UsesPrefix[i] ? *PrefixCompilations : Compilations;
+    };
 
-    std::vector<std::string> SourceFiles = {InputFile};
-    //CWD: current working directory : where to find the src files
-    std::string CWD = ".";
-    //fixed compilation flags: "-x", "c" : treat code as C code
-    //-I: added include paths for standard C++ headers
-    std::vector<std::string> Flags = {"-std=c17", "-x", "c", "-I/usr/include/c++/17", "-I/usr/include/x86_64-linux-gnu/c++/17", "-I/usr/include"};
-    Flags.push_back("-I.");
+    std::unique_ptr<UmbrellaStore> Umbrella;
+    if (!UmbrellaFileName.empty()) {
+        Umbrella = std::make_unique<UmbrellaStore>(UmbrellaFileName);
+    }
 
-    //create a clang tool from .c file and FixedCompilationDatabase ;
-    // the created clang tool has the following infos: CompilerInstance + InFile  
-    clang::tooling::FixedCompilationDatabase Compilations(CWD, Flags);
-    clang::tooling::ClangTool Tool(Compilations, SourceFiles);
+    std::unique_ptr<SharedStatCache> StatCache;
+    if (!StatCacheFileName.empty()) {
+        StatCache = std::make_unique<SharedStatCache>(StatCacheFileName);
+        StatCache->load();
+    }
 
-    
-    // This line of code initiates the entire tool execution process.
-// It can be broken down into the following steps:
-//
-// 1. `std::make_unique<HeaderGeneratorFrontendActionFactory>(HFileName)`:
-//    - This creates a smart pointer (`std::unique_ptr`) to a new instance of
-//      `HeaderGeneratorFrontendActionFactory`, passing the desired output
-//      header filename (`HFileName`) to its constructor.
-//
-// 2. `.get()`:
-//    - This retrieves the raw pointer from the smart pointer. `Tool.run()`
-//      expects a raw pointer to a `FrontendActionFactory`.
-//
-// 3. `Tool.run(...)`:
-//    - The `ClangTool` object's `run()` method takes the factory and begins
-//      the compilation process. It handles the low-level details of setting up
-//      the compiler and parsing the source file (`InputFile`).
-//
-//    - During the run, the following callbacks and actions occur in order:
-//      a. **Factory creates Action**: `Tool.run()` calls the factory's `create()`
-//         method, which returns a `std::unique_ptr<HeaderGeneratorFrontendAction>`.
-//         This action object is responsible for the overall task.
-//
-//      b. **Action creates Consumer**: The `Tool.run()` method then calls the
-//         action's `CreateASTConsumer()` method. It provides a `CompilerInstance`
-//         object (`CI`), which contains the state of the compiler, including
-//         the preprocessor and the `ASTContext`.
-//
-//      c. **Preprocessor runs and collects includes**: Within the `HeaderGeneratorConsumer`'s
-//         constructor, an `IncludeCollector` is added to the preprocessor. CLANG
-//         runs the preprocessor, and the `IncludeCollector`'s `InclusionDirective`
-//         callback is executed for every `#include` directive, populating the
-//         `RequiredHeaders` set.
-//
-//      d. **AST is built**: After preprocessing, CLANG parses the code and builds
-//         the Abstract Syntax Tree (AST).
-//
-//      e. **Consumer processes AST**: `Tool.run()` calls the consumer's
-//         `HandleTranslationUnit()` method, passing the newly created `ASTContext`.
-//         This is where your custom logic takes over.
-//
-//         - `Visitor.TraverseDecl()`: The `HandleTranslationUnit` method
-//           initiates a traversal of the AST using the `FunctionDeclCollector`
-//           visitor.
-//
-//         - `VisitFunctionDecl()`: As the visitor encounters each function
-//           declaration in the AST, its `VisitFunctionDecl()` callback is
-//           executed. This callback extracts the function's details and adds
-//           its declaration string to the `FunctionDeclarations` set.
-//
-//      f. **Header is written**: After the traversal is complete, the
-//         `HandleTranslationUnit` method takes the collected `RequiredHeaders`
-//         and `FunctionDeclarations` and writes them, along with the header
-//         guard, to the specified output file (`HFileName`).
-    return Tool.run(std::make_unique<HeaderGeneratorFrontendActionFactory>(HFileName).get());
-}
\ No newline at end of file
+    int Result = 0;
+
+    //single .c file: run the tool directly
+    if (SourceFiles.size() == 1) {
+        Result = generateHeader(compilationsFor(0), SourceFiles[0], HFileName, Options, Cache.get(), Stats.get(),
+                                Umbrella.get(), StatCache.get());
+        if (Cache) {
+            Cache->save();
+        }
+    }
+    else {
+        Result = generateHeaders(SourceFiles, compilationsFor, Options, Cache.get(), Stats.get(), Jobs, Umbrella.get(),
+                                 StatCache.get());
+    }
+    if (StatCache) {
+        StatCache->printSummary(outs());
+        StatCache->save();
+    }
+
+    //--umbrella: written once all the .c files are merged, if none failed
+    if (Umbrella && Result == 0) {
+        Result = Umbrella->write();
+    }
+
+    //the trace and the stats cover the first run (the watch mode regenerations arent recorded)
+    if (Options.TimeTrace) {
+        if (Error TraceError = timeTraceProfilerWrite(TimeTraceFileName, "generate_header_tool")) {
+            errs() << "Error: Could not write the time trace " << TimeTraceFileName << ": "
+                   << toString(std::move(TraceError)) << "\n";
+            Result = 1;
+        }
+        timeTraceProfilerCleanup();
+        Options.TimeTrace = false;
+    }
+    if (Stats && !StatsFileName.empty()) {
+        Stats->printSummary(outs());
+        if (!Stats->write(StatsFileName)) {
+            Result = 1;
+        }
+    }
+    if (Stats && !ManifestFileName.empty() && !Stats->writeManifest(ManifestFileName, Shard, Shards)) {
+        Result = 1;
+    }
+    Stats.reset();
+
+    if (!Watch) {
+        return Result;
+    }
+
+#ifdef __linux__
+    //watch mode: the compilation databases, the PCH and the cache stay in memory between two regenerations ;
+    //each regeneration gets a new FileManager: a FileManager keeps the size of the files it already read,
+    //it would read a truncated edited .c file. for the same reason the stat cache forgets the files it found
+    //and the cache forgets the hashes of the files it read
+    SourceWatcher Watcher([&](const std::string &File) {
+        bool UsePrefix = Prefix && Prefix->canBeUsedBy(PrecompiledPrefix::scanLeadingSystemHeaders(File));
+        //the .c files use the PCH without clang's check of its inputs (-fno-validate-pch): it is checked here, and
+        //rebuilt if one of its headers changed since it was built (ex: a package update while watching)
+        if (UsePrefix && !Prefix->prepare(Flags)) {
+            UsePrefix = false;
+        }
+        if (UsePrefix) {
+            Options.CommonDependencies = Prefix->getDependencies();
+            if (Cache) {
+                Cache->setCommonDependencies(Prefix->getDependencies());
+            }
+        }
+        const CompilationDatabase &FileCompilations = isCXXSourceFile(File) ? CXXCompilations
+                                                    : UsePrefix             ? *PrefixCompilations
+                                                                            : Compilations;
+        if (Cache) {
+            Cache->invalidate();
+        }
+        if (StatCache) {
+            StatCache->invalidate();
+        }
+        int FileResult = generateHeader(FileCompilations, File, deriveOutputFileName(File, Options),
+                                        Options, Cache.get(), nullptr, nullptr, StatCache.get());
+        if (Cache) {
+            Cache->save();
+        }
+        if (StatCache) {
+            StatCache->save();
+        }
+        return FileResult;
+    });
+    for (const std::string &InputPath : InputPaths) {
+        if (!Watcher.watch(InputPath)) {
+            errs() << "Error: Could not watch " << InputPath << "\n";
+            return 1;
+        }
+    }
+    return Watcher.run();
+#else
+    errs() << "Error: --watch is only supported on Linux.\n";
+    return 1;
+#endif
+}
@@ -0,0 +1,12 @@
+// expect: lexer
+#include <stddef.h>
+
+__attribute__((noreturn)) void fatal(const char *message);
+_Noreturn void stop(int code);
+void *checked_alloc(size_t size) __attribute__((malloc));
+int sample(int x) __attribute__((const));
+
+static inline int square(int x)
+{
+    return x * x;
+}
@@ -0,0 +1,24 @@
+// expect: lexer --emit-module
+#include <stdbool.h>
+
+static int internal_helper(int x);
+
+static int internal_helper(int x)
+{
+    return x + 1;
+}
+
+inline int inline_helper(int x)
+{
+    return x - 1;
+}
+
+bool exported(int x)
+{
+    return internal_helper(x) > inline_helper(x);
+}
+
+int main(void)
+{
+    return exported(1) ? 0 : 1;
+}
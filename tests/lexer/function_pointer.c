@@ -0,0 +1,5 @@
+// expect: fallback declaration of set_handler not read
+typedef void (*handler_t)(int);
+
+void set_handler(void (*handler)(int));
+handler_t current_handler(void);
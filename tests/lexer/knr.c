@@ -0,0 +1,7 @@
+// expect: fallback declaration of old_style not read
+int old_style(a, b)
+    int a;
+    int b;
+{
+    return a + b;
+}
@@ -0,0 +1,4 @@
+// expect: fallback macro API in the declaration of api_call
+#define API
+
+API int api_call(int x);
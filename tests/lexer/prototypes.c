@@ -0,0 +1,24 @@
+// expect: lexer
+#include <stddef.h>
+#include "stdbool.h"
+
+struct node;
+
+_Bool raw_flag(_Bool b);
+bool is_empty(const char *text);
+int no_params(void);
+unsigned count_nodes(struct node *first, unsigned long limit);
+const char *const *names(size_t *count);
+int sum(int count, ...);
+void fill(int values[16], size_t n);
+long long checksum(const unsigned char *data, size_t size);
+
+static int helper(int x)
+{
+    return x * 2;
+}
+
+int twice(int x)
+{
+    return helper(x);
+}
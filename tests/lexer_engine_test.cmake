@@ -0,0 +1,52 @@
+# lexer_engine_test.cmake : checks the lexer engine on the samples of tests/lexer (run by ctest)
+#   cmake -DTOOL=<generate_header_tool> -DSAMPLES_DIR=<tests/lexer> -DWORK_DIR=<dir> -P lexer_engine_test.cmake
+# the first line of each sample says what is expected from `--engine lexer --verify`:
+#   // expect: lexer [flags]           the lexer engine generates the same file as the AST engine (with these flags)
+#   // expect: fallback <reason>       the lexer engine cant read the file: the AST engine is used, for this reason
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+file(GLOB Samples ${SAMPLES_DIR}/*.c)
+
+set(Failures 0)
+foreach(Sample ${Samples})
+    get_filename_component(Name ${Sample} NAME)
+    file(STRINGS ${Sample} Expect LIMIT_COUNT 1)
+    if (NOT Expect MATCHES "^// expect: (lexer|fallback)(.*)$")
+        message(SEND_ERROR "${Name}: no // expect: line")
+        math(EXPR Failures "${Failures} + 1")
+        continue()
+    endif()
+    set(Mode ${CMAKE_MATCH_1})
+    string(STRIP "${CMAKE_MATCH_2}" Argument)
+
+    # each sample is generated alone, in its own directory
+    get_filename_component(Stem ${Sample} NAME_WE)
+    file(MAKE_DIRECTORY ${WORK_DIR}/${Stem})
+    file(COPY ${Sample} DESTINATION ${WORK_DIR}/${Stem})
+    set(Flags)
+    if (Mode STREQUAL "lexer")
+        separate_arguments(Flags UNIX_COMMAND "${Argument}")
+    endif()
+    execute_process(COMMAND ${TOOL} ${WORK_DIR}/${Stem}/${Name} --engine lexer --verify ${Flags}
+                    WORKING_DIRECTORY ${WORK_DIR}/${Stem}
+                    RESULT_VARIABLE Result OUTPUT_VARIABLE Output ERROR_VARIABLE Output)
+
+    set(Error)
+    if (NOT Result EQUAL 0)
+        set(Error "the tool failed")
+    elseif (Mode STREQUAL "lexer" AND Output MATCHES "using the AST engine|disagree")
+        set(Error "the lexer engine wasnt used")
+    elseif (Mode STREQUAL "fallback")
+        string(FIND "${Output}" "${Argument}" Found)
+        if (Found EQUAL -1)
+            set(Error "expected the fallback: ${Argument}")
+        endif()
+    endif()
+    if (Error)
+        message(SEND_ERROR "${Name}: ${Error}\n${Output}")
+        math(EXPR Failures "${Failures} + 1")
+    endif()
+endforeach()
+list(LENGTH Samples Count)
+message(STATUS "${Count} samples, ${Failures} failed")
@@ -0,0 +1,48 @@
+# skip_bodies_test.cmake : checks that --skip-bodies generates the same .h files as the full parse (run by ctest)
+#   cmake -DTOOL=<generate_header_tool> -DWORK_DIR=<dir> -DSOURCE=<.c file> -P skip_bodies_test.cmake
+#   cmake -DTOOL=<generate_header_tool> -DWORK_DIR=<dir> -DCORPUS_TOOL=<generate_c_corpus> -P skip_bodies_test.cmake
+# the .c files (a copy of SOURCE, or a corpus written by CORPUS_TOOL) are generated twice in WORK_DIR: with the full
+# parse, then with --skip-bodies ; the two .h files of each .c file must be identical
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+if (SOURCE)
+    file(COPY ${SOURCE} DESTINATION ${WORK_DIR})
+else()
+    execute_process(COMMAND ${CORPUS_TOOL} --out ${WORK_DIR} --files 8 --functions 50 --variadic 10 --system-includes 8
+                            --local-includes 2 --body-lines 15
+                    RESULT_VARIABLE Result)
+    if (NOT Result EQUAL 0)
+        message(FATAL_ERROR "generate_c_corpus failed")
+    endif()
+endif()
+file(GLOB SourceFiles ${WORK_DIR}/*.c)
+
+# the full parse: the .h files are renamed <name>.full.h ; then --skip-bodies writes <name>.h again
+execute_process(COMMAND ${TOOL} ${WORK_DIR} WORKING_DIRECTORY ${WORK_DIR} RESULT_VARIABLE Result)
+if (NOT Result EQUAL 0)
+    message(FATAL_ERROR "generate_header_tool failed on ${WORK_DIR}")
+endif()
+foreach(SourceFile ${SourceFiles})
+    string(REGEX REPLACE "\\.c$" "" Stem ${SourceFile})
+    file(RENAME ${Stem}.h ${Stem}.full.h)
+endforeach()
+
+execute_process(COMMAND ${TOOL} ${WORK_DIR} --skip-bodies WORKING_DIRECTORY ${WORK_DIR} RESULT_VARIABLE Result)
+if (NOT Result EQUAL 0)
+    message(FATAL_ERROR "generate_header_tool --skip-bodies failed on ${WORK_DIR}")
+endif()
+
+set(Mismatches 0)
+foreach(SourceFile ${SourceFiles})
+    string(REGEX REPLACE "\\.c$" "" Stem ${SourceFile})
+    execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${Stem}.full.h ${Stem}.h RESULT_VARIABLE Different)
+    if (NOT Different EQUAL 0)
+        file(READ ${Stem}.full.h Full)
+        file(READ ${Stem}.h Skipped)
+        message(SEND_ERROR "${SourceFile}: --skip-bodies changed the .h file\n--- full parse:\n${Full}\n--- --skip-bodies:\n${Skipped}")
+        math(EXPR Mismatches "${Mismatches} + 1")
+    endif()
+endforeach()
+list(LENGTH SourceFiles Count)
+message(STATUS "${Count} .c files, ${Mismatches} .h files changed by --skip-bodies")